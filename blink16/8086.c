@@ -14,18 +14,28 @@
 #include "8086.h"
 #include "disasm.h"
 #include "exe.h"        /* required for handleInterrupt/checkStack */
+#include "sched.h"
+#include "timing.h"
+#include "devices.h"
+#include "portio.h"
+#include "checkpoint.h"
+#include "trace.h"
+#include "counters.h"
 
 #if BLINK16
 #include "blink/machine.h"
 #endif
 
 /* emulator globals */
-Word registers[12];
-Byte* byteRegisters[8];
-Byte ram[RAMSIZE];
+union registerFile regs;
+Byte ram[MEMSIZE] __attribute__((aligned(0x4000)));  /* for EMS mapping */
 int f_verbose;
 
-static Byte shadowRam[RAMSIZE];
+static Byte shadowRam[MEMSIZE];
+static DWord textBase = 0xb8000;
+static bool textAll;                    /* text page to be redrawn whole */
+static Byte dirtyPages[DIRTYPAGES / 8]; /* pages written, not yet taken */
+static Byte dirtyFor[DIRTYUSERS][DIRTYPAGES / 8];   /* taken, each user's */
 static bool doShadowCheck;
 static bool useMemory;
 static Word address;
@@ -36,7 +46,6 @@ static Byte modRM;
 static int segment;
 static int segmentOverride;
 static bool wordSize;
-static bool sourceIsRM;
 static DWord data;
 static DWord destination;
 static DWord source;
@@ -47,33 +56,54 @@ static Word savedCS;
 static bool running;
 static bool prefix;
 static bool repeating;
+static bool intShadow;  /* interrupts held off for one instruction */
+static int cpuModel = CPU_8086;
+static bool a20;        /* HMA reachable, else addresses wrap at 1M */
 static int rep;
+static struct insnTiming insn;  /* gathered for the timing model */
+static Word insnIP;             /* first byte of instruction and prefixes */
+static Word traceCS;            /* instruction being traced */
+static Word traceIP;
+static int traceLength;
+static bool traced;
 //static int ios;
 static struct exe *ep;
 
-static inline Word rw(void)          { return registers[opcode & 7]; }
-static inline void setRW(Word value) { registers[opcode & 7] = value; }
-static inline void setRB(Byte value) { *byteRegisters[opcode & 7] = value; }
+static inline Word rw(void)          { return regs.w[opcode & 7]; }
+static inline void setRW(Word value) { regs.w[opcode & 7] = value; }
+static inline void setRB(Byte value) { regs.b[BYTEREG(opcode)] = value; }
 
 void initMachine(struct exe *e)
 {
     memset(ram, 0, sizeof(ram));
     memset(shadowRam, 0, sizeof(shadowRam));
+    textAll = true;
+    memset(dirtyPages, 0, sizeof(dirtyPages));
+    memset(dirtyFor, 0, sizeof(dirtyFor));
+    memset(dirtyFor[DIRTY_CHECKPOINT], 0xff, sizeof(dirtyFor[0]));
     ep = e;          /* saved passed struct exe * for handleInterrupt() */
 
     segment = 0;
     segmentOverride = -1;
     prefix = false;
     repeating = false;
+    intShadow = false;
+    a20 = false;
     running = false;
     doShadowCheck = true;
-
-    setCX(0x00FF);      /* must be 0x00FF as for big endian test below */
-    Byte* byteData = (Byte*)&registers[0];
-    int bigEndian = (byteData[2] == 0 ? 1 : 0);
-    int byteNumbers[8] = {0, 2, 4, 6, 1, 3, 5, 7};
-    for (int i = 0 ; i < 8; ++i)
-        byteRegisters[i] = &byteData[byteNumbers[i] ^ bigEndian];
+    initPorts();
+    initScheduler();
+    resetTiming();
+    initPIC();
+    initPIT();
+    initUART();
+    initA20();
+    addState(&regs, sizeof(regs));
+    addState(&ip, sizeof(ip));
+    addState(&flags, sizeof(flags));
+    addState(&intShadow, sizeof(intShadow));
+    addState(&a20, sizeof(a20));
+    addState(e, sizeof(*e));
 }
 
 void initExecute(void)
@@ -93,11 +123,22 @@ void initExecute(void)
 
 static void farJump();
 static void push(Word value);
+static Word getAccum();
+
+/* trace the instruction so far, the emulator may not return to it */
+static void traceDone(bool interrupt)
+{
+    traceInstruction(traceCS, traceIP, traceLength + insn.length, interrupt);
+    traced = true;
+}
 
 static void performInterrupt(struct exe *e, int intno)
 {
-    if (canHandleInterrupt(e, intno))
+    if (canHandleInterrupt(e, intno)) {
+        if (tracing)
+            traceDone(false);
         handleInterrupt(e, intno);
+    }
     else {
         push(flags);
         push(cs());
@@ -112,6 +153,22 @@ static void performInterrupt(struct exe *e, int intno)
     }
 }
 
+/* word I/O is two byte transfers to consecutive ports, as on the 8088 */
+static Word portIn(Word port, bool wordSize)
+{
+    Word value = inPortByte(port);
+    if (wordSize)
+        value |= inPortByte(port + 1) << 8;
+    return value;
+}
+
+static void portOut(Word port, Word value, bool wordSize)
+{
+    outPortByte(port, value);
+    if (wordSize)
+        outPortByte(port + 1, value >> 8);
+}
+
 static void divideOverflow(void)
 {
     performInterrupt(ep, INT0_DIV_ERROR);
@@ -125,14 +182,14 @@ void setShadowCheck(bool on)
 
 void setShadowFlags(Word offset, int seg, int len, int flags)
 {
-    DWord a = ((DWord)registers[8 + seg] << 4) + offset;
+    DWord a = ((DWord)regs.w[8 + seg] << 4) + offset;
     int i;
 
     if (f_verbose)
         printf("setShadow %04x:%04x len %05x to %x\n",
-            registers[8+seg], offset, len, flags);
+            regs.w[8+seg], offset, len, flags);
     for (i=0; i<len; i++) {
-        if (a < RAMSIZE)
+        if (a < MEMSIZE)
             shadowRam[a++] = flags;
     }
 }
@@ -150,15 +207,17 @@ DWord physicalAddress(Word offset, int seg, int write)
         if (segmentOverride != -1)
             seg = segmentOverride;
     }
-    segmentAddress = registers[8 + seg];
-    a = (((DWord)segmentAddress << 4) + offset) /*& 0xfffff*/;
-    if (a >= RAMSIZE)
-        runtimeError("Accessing address outside RAM %s %04x:%04x\n",
-            segname[seg], segmentAddress, offset);
+    segmentAddress = regs.w[8 + seg];
+    a = ((DWord)segmentAddress << 4) + offset;
+    if (a >= RAMSIZE && !a20)
+        a -= RAMSIZE;
 
     if (!doShadowCheck)
         return a;
+    counters.shadowChecks++;
     flags = shadowRam[a];
+    if (write && !(flags & fWrite) && !running)
+        counters.shadowAvoided++;
     if (write && running && !(flags & fWrite))
         runtimeError("Writing disallowed address %s %04x:%04x\n",
             segname[seg], segmentAddress, offset);
@@ -170,6 +229,127 @@ DWord physicalAddress(Word offset, int seg, int write)
     return a;
 }
 
+/* only a 286 has the address lines for the gate to open */
+void setA20(bool on)
+{
+    a20 = on && cpuModel == CPU_286;
+}
+
+bool getA20(void)
+{
+    return a20;
+}
+
+/* physical address of a linear one, as the A20 gate has it */
+DWord wrapA20(DWord a)
+{
+    return a >= RAMSIZE && !a20 ? a - RAMSIZE : a;
+}
+
+static inline void markDirty(DWord a)
+{
+    dirtyPages[a >> (DIRTYSHIFT + 3)] |= 1 << ((a >> DIRTYSHIFT) & 7);
+}
+
+/*
+ * Mark memory written other than by writeByte and writeWord, as BIOS
+ * services, system calls and the debugger do when they store to ram.
+ */
+void setDirty(DWord a, DWord len)
+{
+    DWord end = a + len;
+
+    if (!len)
+        return;
+    if (end > MEMSIZE)
+        end = MEMSIZE;
+    for (a >>= DIRTYSHIFT; a <= (end - 1) >> DIRTYSHIFT; a++)
+        dirtyPages[a >> 3] |= 1 << (a & 7);
+}
+
+/*
+ * Writes mark one shared bitmap. Each user has its own copy, brought up
+ * to date when one takes it, so a user clearing its pages leaves them
+ * marked for the others.
+ */
+static void collectDirty(void)
+{
+    int i, u;
+    Byte b;
+
+    for (i=0; i<DIRTYPAGES / 8; i++) {
+        if ((b = dirtyPages[i])) {
+            for (u=0; u<DIRTYUSERS; u++)
+                dirtyFor[u][i] |= b;
+            dirtyPages[i] = 0;
+        }
+    }
+}
+
+/* copy and clear the user's written pages bitmap, return false if none */
+bool takeDirty(int user, Byte dirty[DIRTYPAGES / 8])
+{
+    int i;
+    Byte any = 0;
+
+    collectDirty();
+    for (i=0; i<DIRTYPAGES / 8; i++) {
+        any |= dirty[i] = dirtyFor[user][i];
+        dirtyFor[user][i] = 0;
+    }
+    return any != 0;
+}
+
+/* whether any page of a..a+len was written since the user last took them */
+bool testDirty(int user, DWord a, DWord len)
+{
+    DWord end = a + len;
+
+    if (!len)
+        return false;
+    if (end > MEMSIZE)
+        end = MEMSIZE;
+    for (a >>= DIRTYSHIFT; a <= (end - 1) >> DIRTYSHIFT; a++) {
+        if ((dirtyPages[a >> 3] | dirtyFor[user][a >> 3]) & (1 << (a & 7)))
+            return true;
+    }
+    return false;
+}
+
+void setTextBase(DWord base)
+{
+    textBase = base;
+    textAll = true;
+}
+
+/* whether the guest wrote the text page since takeTextDirty */
+bool textChanged(void)
+{
+    return testDirty(DIRTY_TEXT, textBase, TEXTCELLS * 2);
+}
+
+/*
+ * Take the cells of the text page to redraw, those on pages written
+ * since last taken, return false if none. A reset or mode change has
+ * every cell redrawn without making textChanged true.
+ */
+bool takeTextDirty(Byte dirty[TEXTCELLS / 8])
+{
+    static Byte pages[DIRTYPAGES / 8];
+    DWord page;
+    int i;
+    Byte any = 0;
+
+    takeDirty(DIRTY_TEXT, pages);
+    for (i=0; i<TEXTCELLS / 8; i++) {
+        page = (textBase + i * 16) >> DIRTYSHIFT;   /* 8 cells, 16 bytes */
+        dirty[i] = textAll || (pages[page >> 3] & (1 << (page & 7))) ? 0xff : 0;
+        any |= dirty[i];
+    }
+    textAll = false;
+    return any != 0;
+}
+
 Byte readByte(Word offset, int seg)
 {
     DWord a = physicalAddress(offset, seg, false);
@@ -182,6 +362,8 @@ Byte readByte(Word offset, int seg)
 Word readWord(Word offset, int seg)
 {
     DWord a = physicalAddress(offset, seg, false);
+    insn.words++;
+    insn.oddWords += offset & 1;
     Word r = ram[a];
 #if BLINK16
     if (seg != CS) SetReadAddr(g_machine, a, 2);
@@ -193,6 +375,9 @@ void writeByte(Byte value, Word offset, int seg)
 {
     DWord a = physicalAddress(offset, seg, true);
     ram[a] = value;
+    markDirty(a);
+    if (tracing)
+        traceWrite(a, value);
 #if BLINK16
     if (seg != CS) SetWriteAddr(g_machine, a, 1);
 #endif
@@ -201,8 +386,18 @@ void writeByte(Byte value, Word offset, int seg)
 void writeWord(Word value, Word offset, int seg)
 {
     DWord a = physicalAddress(offset, seg, true);
+    DWord b = physicalAddress(offset + 1, seg, true);
+    insn.words++;
+    insn.oddWords += offset & 1;
     ram[a] = value;
-    ram[physicalAddress(offset + 1, seg, true)] = value >> 8;
+    ram[b] = value >> 8;
+    markDirty(a);
+    if ((a ^ b) >> DIRTYSHIFT)      /* word crosses a page */
+        markDirty(b);
+    if (tracing) {
+        traceWrite(a, value);
+        traceWrite(b, value >> 8);
+    }
 #if BLINK16
     if (seg != CS) SetWriteAddr(g_machine, a, 2);
 #endif
@@ -220,7 +415,7 @@ static void writewb(Word value, Word offset, int seg)
     else
         writeByte((Byte)value, offset, seg);
 }
-static Byte fetchByte() { Byte b = readByte(ip, CS); ++ip; return b; }
+static Byte fetchByte() { Byte b = readByte(ip, CS); ++ip; ++insn.length; return b; }
 static Word fetchWord() { Word w = fetchByte(); w += fetchByte() << 8; return w; }
 static Word fetch(bool wordSize)
 {
@@ -240,6 +435,7 @@ static void jumpShort(Byte data, bool jump)
         doJump(ip + signExtend(data));
 }
 bool isRepeating(void) { return repeating; }
+bool inInstruction(void) { return repeating || prefix; }
 Word getIP(void) { return ip; }
 Word getFlags(void) { return flags; }
 void setIP(Word w) { ip = w; }
@@ -416,8 +612,9 @@ static void divide()
     if (dividendNegative)
         residue = (unsigned)-(signed)residue;
 }
-static Word* modRMRW() { return &registers[modRMReg()]; }
-static Byte* modRMRB() { return byteRegisters[modRMReg()]; }
+static Word* modRMRW() { return &regs.w[modRMReg()]; }
+static Word* modRMRS() { return &regs.w[8 + (modRMReg() & 3)]; } /* 8086 ignores bit 2 */
+static Byte* modRMRB() { return &regs.b[BYTEREG(modRMReg())]; }
 static Word getReg()
 {
     if (!wordSize)
@@ -433,9 +630,17 @@ static void setReg(Word value)
     else
         *modRMRW() = value;
 }
+/* effective address clocks by r/m, without and with displacement */
+static const Byte eaClocks[2][8] = {
+    { 7, 8, 8, 7, 5, 5, 6, 5 },
+    { 11, 12, 12, 11, 9, 9, 9, 9 },
+};
+
 static Word ea()
 {
     modRM = fetchByte();
+    insn.ea = eaClocks[(modRM & 0xc0) != 0][modRM & 7] +
+        (segmentOverride != -1 ? 2 : 0);
     useMemory = true;
     switch (modRM & 7) {
         case 0: segment = DS; address = bx() + si(); break;
@@ -466,8 +671,8 @@ static Word readEA2()
 {
     if (!useMemory) {
         if (wordSize)
-            return registers[address];
-        return *byteRegisters[address];
+            return regs.w[address];
+        return regs.b[BYTEREG(address)];
     }
     return readwb(address, -1);
 }
@@ -476,9 +681,9 @@ static void finishWriteEA(Word data)
 {
     if (!useMemory) {
         if (wordSize)
-            registers[address] = data;
+            regs.w[address] = data;
         else
-            *byteRegisters[address] = (Byte)data;
+            regs.b[BYTEREG(address)] = (Byte)data;
     }
     else
         writewb(data, address, -1);
@@ -517,642 +722,1058 @@ static Word incdec(bool decrement)
     return data;
 }
 
-/* execute a single repetition of instruction */
-void executeInstruction(void)
+/*
+ * Opcode handlers, dispatched through opTable[] by executeInstruction.
+ * Each handler sets wordSize itself when its helpers depend on it,
+ * ALU handlers are specialized by operand size and direction.
+ */
+static void opUndefined(void)
 {
-    if (!repeating) {
-        if (!prefix) {
-            segmentOverride = -1;
-            rep = 0;
-        }
-        prefix = false;
-        opcode = fetchByte();
+    handleInterrupt(ep, kMachineUndefinedInstruction);
+}
+
+static void opNop(void)                 /* WAIT, LOCK */
+{
+}
+
+#define ALU_RM(name, size, toReg)               \
+static void name(void)                          \
+{                                               \
+    wordSize = size;                            \
+    data = readEA();                            \
+    if (!toReg) {                               \
+        destination = data;                     \
+        source = getReg();                      \
+    }                                           \
+    else {                                      \
+        destination = getReg();                 \
+        source = data;                          \
+    }                                           \
+    aluOperation = (opcode >> 3) & 7;           \
+    doALUOperation();                           \
+    if (aluOperation != 7) {                    \
+        if (!toReg)                             \
+            finishWriteEA(data);                \
+        else                                    \
+            setReg(data);                       \
+    }                                           \
+}
+
+#define ALU_ACCUM(name, size)                   \
+static void name(void)                          \
+{                                               \
+    wordSize = size;                            \
+    destination = size ? ax() : al();           \
+    source = size ? fetchWord() : fetchByte();  \
+    aluOperation = (opcode >> 3) & 7;           \
+    doALUOperation();                           \
+    if (aluOperation != 7) {                    \
+        if (size)                               \
+            setAX(data);                        \
+        else                                    \
+            setAL(data);                        \
+    }                                           \
+}
+
+ALU_RM(opAluRMB, false, false)          /* alu rmb,rb */
+ALU_RM(opAluRMW, true, false)           /* alu rmw,rw */
+ALU_RM(opAluRB, false, true)            /* alu rb,rmb */
+ALU_RM(opAluRW, true, true)             /* alu rw,rmw */
+ALU_ACCUM(opAluALI, false)              /* alu al,ib */
+ALU_ACCUM(opAluAXI, true)               /* alu ax,iw */
+
+static void opPushSeg(void)
+{
+    push(regs.w[((opcode >> 3) & 7) + 8]);
+}
+
+static void opPopSeg(void)
+{
+    regs.w[((opcode >> 3) & 7) + 8] = pop();
+    if (opcode == 0x17)
+        intShadow = true;
+}
+
+static void opSegment(void)
+{
+    segmentOverride = ((opcode >> 3) & 7) - 4;
+    o("e%ZE"[segmentOverride]);
+    prefix = true;
+}
+
+static void opDAA(void)                 /* DAA, DAS */
+{
+    if (af() || (al() & 0x0f) > 9) {
+        data = al() + (opcode == 0x27 ? 6 : -6);
+        setAL(data);
+        setAF(true);
+        if ((data & 0x100) != 0)
+            setCF(true);
+    }
+    setCF(cf() || al() > 0x9f);
+    if (cf())
+        setAL(al() + (opcode == 0x27 ? 0x60 : -0x60));
+    wordSize = false;
+    data = al();
+    setPZS();
+    o(opcode == 0x27 ? 'y' : 'Y');
+}
+
+static void opAAA(void)                 /* AAA, AAS */
+{
+    if (af() || (al() & 0xf) > 9) {
+        setAL(al() + (opcode == 0x37 ? 6 : -6));
+        setAH(ah() + (opcode == 0x37 ? 1 : -1));
+        setCA();
     }
-    if (rep != 0 && (opcode < 0xa4 || opcode >= 0xb0 || opcode == 0xa8 || opcode == 0xa9))
-        runtimeError("REP prefix with non-string instruction");
-    wordSize = ((opcode & 1) != 0);
-    sourceIsRM = ((opcode & 2) != 0);
-    int operation = (opcode >> 3) & 7;
+    else
+        clearCA();
+    setAL(al() & 0x0f);
+    o(opcode == 0x37 ? 'A' : 'u');
+}
+
+static void opIncDecRW(void)
+{
+    destination = rw();
+    wordSize = true;
+    setRW(incdec((opcode & 8) != 0));
+    o((opcode & 8) != 0 ? 'i' : 'd');
+}
+
+static void opPushRW(void)
+{
+    push(rw());
+}
+
+static void opPopRW(void)
+{
+    setRW(pop());
+}
+
+static void opHLT(void)
+{
+    /* stay halted until an interrupt if one can arrive */
+    if ((flags & IF) && picUnmasked() && idleUntilEvent() && !irqPending)
+        --ip;
+}
+
+static void opInI(void)                 /* IN ib */
+{
+    wordSize = opcode & 1;
+    data = portIn(fetchByte(), wordSize);
+    setAccum();
+}
+
+static void opOutI(void)                /* OUT ib */
+{
+    wordSize = opcode & 1;
+    portOut(fetchByte(), getAccum(), wordSize);
+}
+
+static void opInDX(void)                /* IN dx */
+{
+    wordSize = opcode & 1;
+    data = portIn(dx(), wordSize);
+    setAccum();
+}
+
+static void opOutDX(void)               /* OUT dx */
+{
+    wordSize = opcode & 1;
+    portOut(dx(), getAccum(), wordSize);
+}
+
+static void opJcond(void)               /* Jcond cb */
+{
     bool jump;
 
-    switch (opcode) {
-            case 0x00: case 0x01: case 0x02: case 0x03:
-            case 0x08: case 0x09: case 0x0a: case 0x0b:
-            case 0x10: case 0x11: case 0x12: case 0x13:
-            case 0x18: case 0x19: case 0x1a: case 0x1b:
-            case 0x20: case 0x21: case 0x22: case 0x23:
-            case 0x28: case 0x29: case 0x2a: case 0x2b:
-            case 0x30: case 0x31: case 0x32: case 0x33:
-            case 0x38: case 0x39: case 0x3a: case 0x3b:  // alu rmv,rmv
-                data = readEA();
-                if (!sourceIsRM) {
-                    destination = data;
-                    source = getReg();
-                }
-                else {
-                    destination = getReg();
-                    source = data;
-                }
-                aluOperation = operation;
-                doALUOperation();
-                if (aluOperation != 7) {
-                    if (!sourceIsRM)
-                        finishWriteEA(data);
-                    else
-                        setReg(data);
-                }
-                break;
-            case 0x04: case 0x05: case 0x0c: case 0x0d:
-            case 0x14: case 0x15: case 0x1c: case 0x1d:
-            case 0x24: case 0x25: case 0x2c: case 0x2d:
-            case 0x34: case 0x35: case 0x3c: case 0x3d:  // alu accum,i
-                destination = getAccum();
-                source = !wordSize ? fetchByte() : fetchWord();
-                aluOperation = operation;
-                doALUOperation();
-                if (aluOperation != 7)
-                    setAccum();
-                break;
-            case 0x06: case 0x0e: case 0x16: case 0x1e:  // PUSH segreg
-                push(registers[operation + 8]);
-                break;
-            case 0x07: case 0x17: case 0x1f:  // POP segreg
-                registers[operation + 8] = pop();
+    switch (opcode & 0x0e) {
+        case 0x00: jump = of(); break;
+        case 0x02: jump = cf(); break;
+        case 0x04: jump = zf(); break;
+        case 0x06: jump = cf() || zf(); break;
+        case 0x08: jump = sf(); break;
+        case 0x0a: jump = pf(); break;
+        case 0x0c: jump = sf() != of(); break;
+        default:   jump = sf() != of() || zf(); break;
+    }
+    jumpShort(fetchByte(), jump == ((opcode & 1) == 0));
+    o("MK[)=J(]GgpP<.,>"[opcode & 0xf]);
+}
+
+static void opAluRMI(void)              /* alu rmv,iv */
+{
+    wordSize = opcode & 1;
+    destination = readEA();
+    data = fetch(opcode == 0x81);
+    if (opcode != 0x83)
+        source = data;
+    else
+        source = signExtend(data);
+    aluOperation = modRMReg();
+    doALUOperation();
+    if (aluOperation != 7)
+        finishWriteEA(data);
+}
+
+static void opTestRM(void)              /* TEST rmv,rv */
+{
+    wordSize = opcode & 1;
+    data = readEA();
+    test(data, getReg());
+    o('t');
+}
+
+static void opXchgRM(void)              /* XCHG rmv,rv */
+{
+    wordSize = opcode & 1;
+    data = readEA();
+    finishWriteEA(getReg());
+    setReg(data);
+    o('x');
+}
+
+static void opMovRMR(void)              /* MOV rmv,rv */
+{
+    wordSize = opcode & 1;
+    ea();
+    finishWriteEA(getReg());
+    o('m');
+}
+
+static void opMovRRM(void)              /* MOV rv,rmv */
+{
+    wordSize = opcode & 1;
+    setReg(readEA());
+    o('m');
+}
+
+static void opMovRMSeg(void)            /* MOV rmw,segreg */
+{
+    ea();
+    wordSize = true;
+    finishWriteEA(*modRMRS());
+    o('m');
+}
+
+static void opLEA(void)
+{
+    address = ea();
+    if (!useMemory)
+        runtimeError("LEA needs a memory address");
+    wordSize = true;
+    setReg(address);
+    o('l');
+}
+
+static void opMovSegRM(void)            /* MOV segreg,rmw */
+{
+    wordSize = true;
+    data = readEA();
+    *modRMRS() = data;
+    if ((modRMReg() & 3) == SS)
+        intShadow = true;
+    o('m');
+}
+
+static void opPopRM(void)               /* POP rmw */
+{
+    wordSize = true;
+    writeEA(pop());
+}
+
+static void opXchgAX(void)              /* XCHG AX,rw */
+{
+    data = ax();
+    setAX(rw());
+    setRW(data);
+    o(";xxxxxxx"[opcode & 7]);
+}
+
+static void opCBW(void)
+{
+    setAX(signExtend(al()));
+    o('b');
+}
+
+static void opCWD(void)
+{
+    setDX((ax() & 0x8000) == 0 ? 0x0000 : 0xffff);
+    o('w');
+}
+
+static void opCallFar(void)             /* CALL cp */
+{
+    savedIP = fetchWord();
+    savedCS = fetchWord();
+    o('c');
+    farCall();
+}
+
+static void opPUSHF(void)
+{
+    o('U');
+    /* the 286 reads flags bits 12-15 as zero in real mode */
+    push((flags & 0x0fd7) | (cpuModel >= CPU_286 ? 0 : 0xf000));
+}
+
+static void opPOPF(void)
+{
+    o('O');
+    flags = pop() | 2;
+}
+
+static void opSAHF(void)
+{
+    flags = (flags & 0xff02) | ah();
+    o('s');
+}
+
+static void opLAHF(void)
+{
+    setAH(flags & 0xd7);
+    o('L');
+}
+
+static void opMovAccMem(void)           /* MOV accum,xv */
+{
+    wordSize = opcode & 1;
+    segment = DS;
+    data = readwb(fetchWord(), -1);
+    setAccum();
+    o('m');
+}
+
+static void opMovMemAcc(void)           /* MOV xv,accum */
+{
+    wordSize = opcode & 1;
+    segment = DS;
+    writewb(getAccum(), fetchWord(), -1);
+    o('m');
+}
+
+static void opMOVS(void)
+{
+    wordSize = opcode & 1;
+    if (rep == 0 || cx() != 0)
+        stoS(lodS());
+    doRep(false);
+    o('4' + (opcode & 1));
+}
+
+static void opCMPS(void)
+{
+    wordSize = opcode & 1;
+    if (rep == 0 || cx() != 0) {
+        destination = lodS();
+        source = lodDIS();
+        sub();
+    }
+    doRep(true);
+    o('0' + (opcode & 1));
+}
+
+static void opTestAcc(void)             /* TEST accum,iv */
+{
+    wordSize = opcode & 1;
+    data = fetch(wordSize);
+    test(getAccum(), data);
+    o('t');
+}
+
+static void opSTOS(void)
+{
+    wordSize = opcode & 1;
+    if (rep == 0 || cx() != 0)
+        stoS(getAccum());
+    doRep(false);
+    o('8' + (opcode & 1));
+}
+
+static void opLODS(void)
+{
+    wordSize = opcode & 1;
+    if (rep == 0 || cx() != 0) {
+        data = lodS();
+        setAccum();
+    }
+    doRep(false);
+    o('2' + (opcode & 1));
+}
+
+static void opSCAS(void)
+{
+    wordSize = opcode & 1;
+    if (rep == 0 || cx() != 0) {
+        destination = getAccum();
+        source = lodDIS();
+        sub();
+    }
+    doRep(true);
+    o('6' + (opcode & 1));
+}
+
+static void opMovRBI(void)              /* MOV rb,ib */
+{
+    setRB(fetchByte());
+    o('m');
+}
+
+static void opMovRWI(void)              /* MOV rw,iw */
+{
+    setRW(fetchWord());
+    o('m');
+}
+
+static void opRET(void)                 /* RET, RETF, with or without iw */
+{
+    savedIP = pop();
+    savedCS = (opcode & 8) == 0 ? cs() : pop();
+    if (!(opcode & 1))
+        setSP(sp() + fetchWord());
+    o('R');
+    farJump();
+}
+
+static void opLESLDS(void)
+{
+    ea();
+    farLoad();
+    *modRMRW() = savedIP;
+    regs.w[8 + (!(opcode & 1) ? 0 : 3)] = savedCS;
+    o("NT"[opcode & 1]);
+}
+
+static void opMovRMI(void)              /* MOV rmv,iv */
+{
+    wordSize = opcode & 1;
+    ea();
+    finishWriteEA(fetch(wordSize));
+    o('m');
+}
+
+static void opINT3(void)
+{
+    performInterrupt(ep, INT3_BREAKPOINT);
+}
+
+static void opINT(void)
+{
+    performInterrupt(ep, fetchByte());
+    o('$');
+}
+
+static void opINTO(void)
+{
+    performInterrupt(ep, INT4_OVERFLOW);
+}
+
+static void opIRET(void)
+{
+    o('I');
+    doJump(pop());
+    setCS(pop());
+    flags = pop() | 0xF002;
+    if (!cs() && !ip) runtimeError("IRET to 0:0!\n");
+}
+
+static void opRotate(void)              /* rot rmv,n */
+{
+    wordSize = opcode & 1;
+    data = readEA();
+    if (opcode < 0xd0)                  /* rot rmv,ib */
+        source = fetchByte();
+    else if ((opcode & 2) == 0)
+        source = 1;
+    else
+        source = cl();
+    if (cpuModel >= CPU_186)
+        source &= 0x1f;
+    insn.count = source;
+    while (source != 0) {
+        destination = data;
+        switch (modRMReg()) {
+            case 0:  // ROL
+                data <<= 1;
+                doCF();
+                data |= (cf() ? 1 : 0);
+                setOFRotate();
+                break;
+            case 1:  // ROR
+                setCF((data & 1) != 0);
+                data >>= 1;
+                if (cf())
+                    data |= (!wordSize ? 0x80 : 0x8000);
+                setOFRotate();
                 break;
-            case 0x26: case 0x2e: case 0x36: case 0x3e:  // segment override
-                segmentOverride = operation - 4;
-                o("e%ZE"[segmentOverride]);
-                prefix = true;
+            case 2:  // RCL
+                data = (data << 1) | (cf() ? 1 : 0);
+                doCF();
+                setOFRotate();
                 break;
-            case 0x27:              // DAA
-            case 0x2f:              // DAS
-                if (af() || (al() & 0x0f) > 9) {
-                    data = al() + (opcode == 0x27 ? 6 : -6);
-                    setAL(data);
-                    setAF(true);
-                    if ((data & 0x100) != 0)
-                        setCF(true);
-                }
-                setCF(cf() || al() > 0x9f);
+            case 3:  // RCR
+                data >>= 1;
                 if (cf())
-                    setAL(al() + (opcode == 0x27 ? 0x60 : -0x60));
-                wordSize = false;
-                data = al();
+                    data |= (!wordSize ? 0x80 : 0x8000);
+                setCF((destination & 1) != 0);
+                setOFRotate();
+                break;
+            case 4:  // SHL
+            case 6:
+                data <<= 1;
+                doCF();
+                setOFRotate();
                 setPZS();
-                o(opcode == 0x27 ? 'y' : 'Y');
-                break;
-            case 0x37:              // AAA
-            case 0x3f:              // AAS
-                if (af() || (al() & 0xf) > 9) {
-                    setAL(al() + (opcode == 0x37 ? 6 : -6));
-                    setAH(ah() + (opcode == 0x37 ? 1 : -1));
-                    setCA();
-                }
-                else
-                    clearCA();
-                setAL(al() & 0x0f);
-                o(opcode == 0x37 ? 'A' : 'u');
-                break;
-            case 0x40: case 0x41: case 0x42: case 0x43:
-            case 0x44: case 0x45: case 0x46: case 0x47:
-            case 0x48: case 0x49: case 0x4a: case 0x4b:
-            case 0x4c: case 0x4d: case 0x4e: case 0x4f:  // incdec rw
-                destination = rw();
-                wordSize = true;
-                setRW(incdec((opcode & 8) != 0));
-                o((opcode & 8) != 0 ? 'i' : 'd');
-                break;
-            case 0x50: case 0x51: case 0x52: case 0x53:
-            case 0x54: case 0x55: case 0x56: case 0x57:  // PUSH rw
-                push(rw());
-                break;
-            case 0x58: case 0x59: case 0x5a: case 0x5b:
-            case 0x5c: case 0x5d: case 0x5e: case 0x5f:  // POP rw
-                setRW(pop());
-                break;
-            case 0x60: case 0x61: case 0x62: case 0x63:
-            case 0x64:  // FS
-            case 0x65:  // GS
-            case 0x66:  // DATA32
-            case 0x67:  // ADDR32
-            case 0x68: case 0x69: case 0x6a: case 0x6b:
-            case 0x6c: case 0x6d: case 0x6e: case 0x6f:
-            case 0xc0: case 0xc1: case 0xc8: case 0xc9:  // invalid
-            case 0xf1:
-            case 0xd8: case 0xd9: case 0xda: case 0xdb:
-            case 0xdc: case 0xdd: case 0xde: case 0xdf:  // escape
-            case 0x0f:  // POP CS
-                handleInterrupt(ep, kMachineUndefinedInstruction);
-                break;
-            case 0x9b:  // WAIT
-            case 0xf0:  // LOCK
-                break;
-            case 0xf4:  // HLT
-                break;  // FIXME possible interrupt?
-            case 0xe4: case 0xe5:   // IN ib
-                (void)fetchByte();
-                //FIXME implement, returns -1 for now
-                data = -1; setAccum();
-                break;
-            case 0xe6: case 0xe7:   // OUT ib
-                (void)fetchByte();
-                //FIXME implement
                 break;
-            case 0xec: case 0xed:   // IN dx
-                //FIXME implement, returns -1 for now
-                data = -1; setAccum();
-                break;
-            case 0xee: case 0xef:   // OUT dx
-                //FIXME implement
-                break;
-            case 0x70: case 0x71: case 0x72: case 0x73:
-            case 0x74: case 0x75: case 0x76: case 0x77:
-            case 0x78: case 0x79: case 0x7a: case 0x7b:
-            case 0x7c: case 0x7d: case 0x7e: case 0x7f:  // Jcond cb
-                switch (opcode & 0x0e) {
-                    case 0x00: jump = of(); break;
-                    case 0x02: jump = cf(); break;
-                    case 0x04: jump = zf(); break;
-                    case 0x06: jump = cf() || zf(); break;
-                    case 0x08: jump = sf(); break;
-                    case 0x0a: jump = pf(); break;
-                    case 0x0c: jump = sf() != of(); break;
-                    default:   jump = sf() != of() || zf(); break;
-                }
-                jumpShort(fetchByte(), jump == ((opcode & 1) == 0));
-                o("MK[)=J(]GgpP<.,>"[opcode & 0xf]);
+            case 5:  // SHR
+                setCF((data & 1) != 0);
+                data >>= 1;
+                setOFRotate();
+                setAF(true);
+                setPZS();
                 break;
-            case 0x80: case 0x81: case 0x82: case 0x83:  // alu rmv,iv
-                destination = readEA();
-                data = fetch(opcode == 0x81);
-                if (opcode != 0x83)
-                    source = data;
+            case 7:  // SAR
+                setCF((data & 1) != 0);
+                data >>= 1;
+                if (!wordSize)
+                    data |= (destination & 0x80);
                 else
-                    source = signExtend(data);
-                aluOperation = modRMReg();
-                doALUOperation();
-                if (aluOperation != 7)
-                    finishWriteEA(data);
-                break;
-            case 0x84: case 0x85:  // TEST rmv,rv
-                data = readEA();
-                test(data, getReg());
-                o('t');
-                break;
-            case 0x86: case 0x87:  // XCHG rmv,rv
-                data = readEA();
-                finishWriteEA(getReg());
-                setReg(data);
-                o('x');
-                break;
-            case 0x88: case 0x89:  // MOV rmv,rv
-                ea();
-                finishWriteEA(getReg());
-                o('m');
-                break;
-            case 0x8a: case 0x8b:  // MOV rv,rmv
-                setReg(readEA());
-                o('m');
-                break;
-            case 0x8c:  // MOV rmw,segreg
-                ea();
-                wordSize = 1;
-                finishWriteEA(registers[modRMReg() + 8]);
-                o('m');
-                break;
-            case 0x8d:  // LEA
-                address = ea();
-                if (!useMemory)
-                    runtimeError("LEA needs a memory address");
-                setReg(address);
-                o('l');
-                break;
-            case 0x8e:  // MOV segreg,rmw
-                wordSize = 1;
-                data = readEA();
-                registers[modRMReg() + 8] = data;
-                o('m');
-                break;
-            case 0x8f:  // POP rmw
-                writeEA(pop());
-                break;
-            case 0x90: case 0x91: case 0x92: case 0x93:
-            case 0x94: case 0x95: case 0x96: case 0x97:  // XCHG AX,rw
-                data = ax();
-                setAX(rw());
-                setRW(data);
-                o(";xxxxxxx"[opcode & 7]);
-                break;
-            case 0x98:  // CBW
-                setAX(signExtend(al()));
-                o('b');
-                break;
-            case 0x99:  // CWD
-                setDX((ax() & 0x8000) == 0 ? 0x0000 : 0xffff);
-                o('w');
-                break;
-            case 0x9a:  // CALL cp
-                savedIP = fetchWord();
-                savedCS = fetchWord();
-                o('c');
-                farCall();
-                break;
-            case 0x9c:  // PUSHF
-                o('U');
-                push((flags & 0x0fd7) | 0xf000);
-                break;
-            case 0x9d:  // POPF
-                o('O');
-                flags = pop() | 2;
-                break;
-            case 0x9e:  // SAHF
-                flags = (flags & 0xff02) | ah();
-                o('s');
-                break;
-            case 0x9f:  // LAHF
-                setAH(flags & 0xd7);
-                o('L');
-                break;
-            case 0xa0: case 0xa1:  // MOV accum,xv
-                segment = DS;
-                data = readwb(fetchWord(), -1);
-                setAccum();
-                o('m');
-                break;
-            case 0xa2: case 0xa3:  // MOV xv,accum
-                segment = DS;
-                writewb(getAccum(), fetchWord(), -1);
-                o('m');
-                break;
-            case 0xa4: case 0xa5:  // MOVSv
-                if (rep == 0 || cx() != 0)
-                    stoS(lodS());
-                doRep(false);
-                o('4' + (opcode & 1));
+                    data |= (destination & 0x8000);
+                setOFRotate();
+                setAF(true);
+                setPZS();
                 break;
-            case 0xa6: case 0xa7:  // CMPSv
-                if (rep == 0 || cx() != 0) {
-                    destination = lodS();
-                    source = lodDIS();
-                    sub();
+        }
+        --source;
+    }
+    finishWriteEA(data);
+    o("hHfFvVvW"[modRMReg()]);
+}
+
+static void opAAM(void)
+{
+    data = fetchByte();
+    if (data == 0)
+        divideOverflow();
+    setAH(al() / data);
+    setAL(al() % data);
+    wordSize = true;
+    setPZS();
+    o('n');
+}
+
+static void opAAD(void)
+{
+    data = fetchByte();
+    setAL(al() + ah()*data);
+    setAH(0);
+    wordSize = true;
+    setPZS();
+    o('k');
+}
+
+static void opSALC(void)
+{
+    setAL(cf() ? 0xff : 0x00);
+    o('S');
+}
+
+static void opXLATB(void)
+{
+    setAL(readByte(bx() + al(), -1));
+    o('@');
+}
+
+static void opLOOP(void)                /* LOOPc cb */
+{
+    bool jump;
+
+    setCX(cx() - 1);
+    jump = (cx() != 0);
+    switch (opcode) {
+        case 0xe0: if (zf()) jump = false; break;
+        case 0xe1: if (!zf()) jump = false; break;
+    }
+    o("Qqo"[opcode & 3]);
+    jumpShort(fetchByte(), jump);
+}
+
+static void opJCXZ(void)
+{
+    o('z');
+    jumpShort(fetchByte(), cx() == 0);
+}
+
+static void opCallNear(void)            /* CALL cw */
+{
+    data = fetchWord();
+    o('c');
+    call(ip + data);
+}
+
+static void opJmpNear(void)             /* JMP cw */
+{
+    o('j');
+    data = fetchWord();
+    doJump(ip + data);
+}
+
+static void opJmpFar(void)              /* JMP cp */
+{
+    o('j');
+    savedIP = fetchWord();
+    savedCS = fetchWord();
+    farJump();
+}
+
+static void opJmpShort(void)            /* JMP cb */
+{
+    o('j');
+    jumpShort(fetchByte(), true);
+}
+
+static void opREP(void)                 /* REPNZ, REPZ */
+{
+    o('r');
+    rep = opcode == 0xf2 ? 1 : 2;
+    prefix = true;
+}
+
+static void opCMC(void)
+{
+    o('\"');
+    flags ^= 1;
+}
+
+static void opMath(void)                /* math rmv */
+{
+    wordSize = opcode & 1;
+    data = readEA();
+    switch (modRMReg()) {
+        case 0: case 1:  // TEST rmv,iv
+            test(data, fetch(wordSize));
+            o('t');
+            break;
+        case 2:  // NOT iv
+            finishWriteEA(~data);
+            o('~');
+            break;
+        case 3:  // NEG iv
+            source = data;
+            destination = 0;
+            sub();
+            finishWriteEA(data);
+            o('_');
+            break;
+        case 4: case 5:  // MUL rmv, IMUL rmv
+            source = data;
+            destination = getAccum();
+            data = destination;
+            setSF();
+            setPF();
+            data *= source;
+            setAX(data);
+            if (!wordSize) {
+                if (modRMReg() == 4)
+                    setCF(ah() != 0);
+                else {
+                    if ((source & 0x80) != 0)
+                        setAH(ah() - destination);
+                    if ((destination & 0x80) != 0)
+                        setAH(ah() - source);
+                    setCF(ah() ==
+                        ((al() & 0x80) == 0 ? 0 : 0xff));
                 }
-                doRep(true);
-                o('0' + (opcode & 1));
-                break;
-            case 0xa8: case 0xa9:  // TEST accum,iv
-                data = fetch(wordSize);
-                test(getAccum(), data);
-                o('t');
-                break;
-            case 0xaa: case 0xab:  // STOSv
-                if (rep == 0 || cx() != 0)
-                    stoS(getAccum());
-                doRep(false);
-                o('8' + (opcode & 1));
-                break;
-            case 0xac: case 0xad:  // LODSv
-                if (rep == 0 || cx() != 0) {
-                    data = lodS();
-                    setAccum();
+            }
+            else {
+                setDX(data >> 16);
+                if (modRMReg() == 4) {
+                    data |= dx();
+                    setCF(dx() != 0);
                 }
-                doRep(false);
-                o('2' + (opcode & 1));
-                break;
-            case 0xae: case 0xaf:  // SCASv
-                if (rep == 0 || cx() != 0) {
-                    destination = getAccum();
-                    source = lodDIS();
-                    sub();
+                else {
+                    if ((source & 0x8000) != 0)
+                        setDX(dx() - destination);
+                    if ((destination & 0x8000) != 0)
+                        setDX(dx() - source);
+                    data |= dx();
+                    setCF(dx() ==
+                        ((ax() & 0x8000) == 0 ? 0 : 0xffff));
                 }
-                doRep(true);
-                o('6' + (opcode & 1));
-                break;
-            case 0xb0: case 0xb1: case 0xb2: case 0xb3:
-            case 0xb4: case 0xb5: case 0xb6: case 0xb7:
-                setRB(fetchByte());
-                o('m');
-                break;
-            case 0xb8: case 0xb9: case 0xba: case 0xbb:
-            case 0xbc: case 0xbd: case 0xbe: case 0xbf:  // MOV rv,iv
-                setRW(fetchWord());
-                o('m');
-                break;
-            case 0xc2: case 0xc3: case 0xca: case 0xcb:  // RET
-                savedIP = pop();
-                savedCS = (opcode & 8) == 0 ? cs() : pop();
-                if (!wordSize)
-                    setSP(sp() + fetchWord());
-                o('R');
-                farJump();
-                break;
-            case 0xc4: case 0xc5:  // LES/LDS
-                ea();
-                farLoad();
-                *modRMRW() = savedIP;
-                registers[8 + (!wordSize ? 0 : 3)] = savedCS;
-                o("NT"[opcode & 1]);
-                break;
-            case 0xc6: case 0xc7:  // MOV rmv,iv
-                ea();
-                finishWriteEA(fetch(wordSize));
-                o('m');
-                break;
-            case 0xcc:  // INT 3
-                performInterrupt(ep, INT3_BREAKPOINT);
-                break;
-            case 0xcd:
-                performInterrupt(ep, fetchByte());
-                o('$');
-                break;
-            case 0xce:  // INTO
-                performInterrupt(ep, INT4_OVERFLOW);
-                break;
-            case 0xcf:  // IRET
-                o('I');
-                doJump(pop());
-                setCS(pop());
-                flags = pop() | 0xF002;
-                if (!cs() && !ip) runtimeError("IRET to 0:0!\n");
-                break;
-            case 0xd0: case 0xd1: case 0xd2: case 0xd3:  // rot rmv,n
-                data = readEA();
-                if ((opcode & 2) == 0)
-                    source = 1;
-                else
-                    source = cl();
-                while (source != 0) {
-                    destination = data;
-                    switch (modRMReg()) {
-                        case 0:  // ROL
-                            data <<= 1;
-                            doCF();
-                            data |= (cf() ? 1 : 0);
-                            setOFRotate();
-                            break;
-                        case 1:  // ROR
-                            setCF((data & 1) != 0);
-                            data >>= 1;
-                            if (cf())
-                                data |= (!wordSize ? 0x80 : 0x8000);
-                            setOFRotate();
-                            break;
-                        case 2:  // RCL
-                            data = (data << 1) | (cf() ? 1 : 0);
-                            doCF();
-                            setOFRotate();
-                            break;
-                        case 3:  // RCR
-                            data >>= 1;
-                            if (cf())
-                                data |= (!wordSize ? 0x80 : 0x8000);
-                            setCF((destination & 1) != 0);
-                            setOFRotate();
-                            break;
-                        case 4:  // SHL
-                        case 6:
-                            data <<= 1;
-                            doCF();
-                            setOFRotate();
-                            setPZS();
-                            break;
-                        case 5:  // SHR
-                            setCF((data & 1) != 0);
-                            data >>= 1;
-                            setOFRotate();
-                            setAF(true);
-                            setPZS();
-                            break;
-                        case 7:  // SAR
-                            setCF((data & 1) != 0);
-                            data >>= 1;
-                            if (!wordSize)
-                                data |= (destination & 0x80);
-                            else
-                                data |= (destination & 0x8000);
-                            setOFRotate();
-                            setAF(true);
-                            setPZS();
-                            break;
-                    }
-                    --source;
+            }
+            setZF();
+            setOF(cf());
+            o("*#"[opcode & 1]);
+            break;
+        case 6: case 7:  // DIV rmv, IDIV rmv
+            source = data;
+            if (source == 0)
+                divideOverflow();
+            if (!wordSize) {
+                destination = ax();
+                if (modRMReg() == 6) {
+                    divide();
+                    if (data > 0xff)
+                        divideOverflow();
                 }
-                finishWriteEA(data);
-                o("hHfFvVvW"[modRMReg()]);
-                break;
-            case 0xd4:  // AAM
-                data = fetchByte();
-                if (data == 0)
-                    divideOverflow();
-                setAH(al() / data);
-                setAL(al() % data);
-                wordSize = true;
-                setPZS();
-                o('n');
-                break;
-            case 0xd5:  // AAD
-                data = fetchByte();
-                setAL(al() + ah()*data);
-                setAH(0);
-                setPZS();
-                o('k');
-                break;
-            case 0xd6:  // SALC
-                setAL(cf() ? 0xff : 0x00);
-                o('S');
-                break;
-            case 0xd7:  // XLATB
-                setAL(readByte(bx() + al(), -1));
-                o('@');
-                break;
-            case 0xe0: case 0xe1: case 0xe2:  // LOOPc cb
-                setCX(cx() - 1);
-                jump = (cx() != 0);
-                switch (opcode) {
-                    case 0xe0: if (zf()) jump = false; break;
-                    case 0xe1: if (!zf()) jump = false; break;
+                else {
+                    destination = ax();
+                    if ((destination & 0x8000) != 0)
+                        destination |= 0xffff0000;
+                    source = signExtend(source);
+                    divide();
+                    if (data > 0x7f && data < 0xffffff80)
+                        divideOverflow();
                 }
-                o("Qqo"[opcode & 3]);
-                jumpShort(fetchByte(), jump);
-                break;
-            case 0xe3:  // JCXZ cb
-                o('z');
-                jumpShort(fetchByte(), cx() == 0);
-                break;
-            case 0xe8:  // CALL cw
-                data = fetchWord();
-                o('c');
-                call(ip + data);
-                break;
-            case 0xe9:  // JMP cw
-                o('j');
-                data = fetchWord();
-                doJump(ip + data);
-                break;
-            case 0xea:  // JMP cp
-                o('j');
-                savedIP = fetchWord();
-                savedCS = fetchWord();
-                farJump();
-                break;
-            case 0xeb:  // JMP cb
-                o('j');
-                jumpShort(fetchByte(), true);
-                break;
-            case 0xf2:  // REPNZ
-            case 0xf3:  // REPZ
-                o('r');
-                rep = opcode == 0xf2 ? 1 : 2;
-                prefix = true;
-                break;
-            case 0xf5:  // CMC
-                o('\"');
-                flags ^= 1;
-                break;
-            case 0xf6: case 0xf7:  // math rmv
-                data = readEA();
-                switch (modRMReg()) {
-                    case 0: case 1:  // TEST rmv,iv
-                        test(data, fetch(wordSize));
-                        o('t');
-                        break;
-                    case 2:  // NOT iv
-                        finishWriteEA(~data);
-                        o('~');
-                        break;
-                    case 3:  // NEG iv
-                        source = data;
-                        destination = 0;
-                        sub();
-                        finishWriteEA(data);
-                        o('_');
-                        break;
-                    case 4: case 5:  // MUL rmv, IMUL rmv
-                        source = data;
-                        destination = getAccum();
-                        data = destination;
-                        setSF();
-                        setPF();
-                        data *= source;
-                        setAX(data);
-                        if (!wordSize) {
-                            if (modRMReg() == 4)
-                                setCF(ah() != 0);
-                            else {
-                                if ((source & 0x80) != 0)
-                                    setAH(ah() - destination);
-                                if ((destination & 0x80) != 0)
-                                    setAH(ah() - source);
-                                setCF(ah() ==
-                                    ((al() & 0x80) == 0 ? 0 : 0xff));
-                            }
-                        }
-                        else {
-                            setDX(data >> 16);
-                            if (modRMReg() == 4) {
-                                data |= dx();
-                                setCF(dx() != 0);
-                            }
-                            else {
-                                if ((source & 0x8000) != 0)
-                                    setDX(dx() - destination);
-                                if ((destination & 0x8000) != 0)
-                                    setDX(dx() - source);
-                                data |= dx();
-                                setCF(dx() ==
-                                    ((ax() & 0x8000) == 0 ? 0 : 0xffff));
-                            }
-                        }
-                        setZF();
-                        setOF(cf());
-                        o("*#"[opcode & 1]);
-                        break;
-                    case 6: case 7:  // DIV rmv, IDIV rmv
-                        source = data;
-                        if (source == 0)
-                            divideOverflow();
-                        if (!wordSize) {
-                            destination = ax();
-                            if (modRMReg() == 6) {
-                                divide();
-                                if (data > 0xff)
-                                    divideOverflow();
-                            }
-                            else {
-                                destination = ax();
-                                if ((destination & 0x8000) != 0)
-                                    destination |= 0xffff0000;
-                                source = signExtend(source);
-                                divide();
-                                if (data > 0x7f && data < 0xffffff80)
-                                    divideOverflow();
-                            }
-                            setAH((Byte)residue);
-                            setAL(data);
-                        }
-                        else {
-                            destination = (dx() << 16) + ax();
-                            divide();
-                            if (modRMReg() == 6) {
-                                if (data > 0xffff)
-                                    divideOverflow();
-                            }
-                            else {
-                                if (data > 0x7fff && data < 0xffff8000)
-                                    divideOverflow();
-                            }
-                            setDX(residue);
-                            setAX(data);
-                        }
-                        o("/\\"[opcode & 1]);
-                        break;
+                setAH((Byte)residue);
+                setAL(data);
+            }
+            else {
+                destination = (dx() << 16) + ax();
+                divide();
+                if (modRMReg() == 6) {
+                    if (data > 0xffff)
+                        divideOverflow();
                 }
-                break;
-            case 0xf8: case 0xf9:  // STC/CLC
-                setCF(wordSize);
-                o("\'`"[opcode & 1]);
-                break;
-            case 0xfa: case 0xfb:  // STI/CLI
-                setIF(wordSize);
-                o("!:"[opcode & 1]);
-                break;
-            case 0xfc: case 0xfd:  // STD/CLD
-                setDF(wordSize);
-                o("CD"[opcode & 1]);
-                break;
-            case 0xfe: case 0xff:  // misc
-                ea();
-                if ((!wordSize && modRMReg() >= 2 && modRMReg() <= 6) ||
-                    modRMReg() == 7) {
-                        runtimeError("Invalid instruction %02x %02x", opcode, modRM);
+                else {
+                    if (data > 0x7fff && data < 0xffff8000)
+                        divideOverflow();
                 }
-                switch (modRMReg()) {
-                    case 0: case 1:  // incdec rmv
-                        destination = readEA2();
-                        finishWriteEA(incdec(modRMReg() != 0));
-                        o("id"[modRMReg() & 1]);
-                        break;
-                    case 2:  // CALL rmv
-                        o('c');
-                        call(readEA2());
-                        break;
-                    case 3:  // CALL mp
-                        o('c');
-                        farLoad();
-                        farCall();
-                        break;
-                    case 4:  // JMP rmw
-                        o('j');
-                        doJump(readEA2());
-                        break;
-                    case 5:  // JMP mp
-                        o('j');
-                        farLoad();
-                        farJump();
-                        break;
-                    case 6:  // PUSH rmw
-                        push(readEA2());
-                        break;
+                setDX(residue);
+                setAX(data);
+            }
+            o("/\\"[opcode & 1]);
+            break;
+    }
+}
+
+static void opSetCF(void)               /* STC/CLC */
+{
+    setCF(opcode & 1);
+    o("\'`"[opcode & 1]);
+}
+
+static void opSetIF(void)               /* STI/CLI */
+{
+    if ((opcode & 1) && !(flags & IF))
+        intShadow = true;
+    setIF(opcode & 1);
+    o("!:"[opcode & 1]);
+}
+
+static void opSetDF(void)               /* STD/CLD */
+{
+    setDF(opcode & 1);
+    o("CD"[opcode & 1]);
+}
+
+static void opMisc(void)                /* misc */
+{
+    wordSize = opcode & 1;
+    ea();
+    if ((!wordSize && modRMReg() >= 2 && modRMReg() <= 6) ||
+        modRMReg() == 7) {
+            runtimeError("Invalid instruction %02x %02x", opcode, modRM);
+    }
+    switch (modRMReg()) {
+        case 0: case 1:  // incdec rmv
+            destination = readEA2();
+            finishWriteEA(incdec(modRMReg() != 0));
+            o("id"[modRMReg() & 1]);
+            break;
+        case 2:  // CALL rmv
+            o('c');
+            call(readEA2());
+            break;
+        case 3:  // CALL mp
+            o('c');
+            farLoad();
+            farCall();
+            break;
+        case 4:  // JMP rmw
+            o('j');
+            doJump(readEA2());
+            break;
+        case 5:  // JMP mp
+            o('j');
+            farLoad();
+            farJump();
+            break;
+        case 6:  // PUSH rmw
+            push(readEA2());
+            break;
+    }
+}
+
+/* 80186 and later instructions, installed into opTable by setCPU */
+static void opPUSHA(void)
+{
+    Word temp = sp();
+
+    push(ax());
+    push(cx());
+    push(dx());
+    push(bx());
+    push(temp);
+    push(bp());
+    push(si());
+    push(di());
+}
+
+static void opPOPA(void)
+{
+    setDI(pop());
+    setSI(pop());
+    setBP(pop());
+    pop();
+    setBX(pop());
+    setDX(pop());
+    setCX(pop());
+    setAX(pop());
+}
+
+static void opBOUND(void)
+{
+    short index, lower, upper;
+
+    ea();
+    if (!useMemory)
+        runtimeError("BOUND needs a memory address");
+    index = *modRMRW();
+    lower = readWord(address, -1);
+    upper = readWord(address + 2, -1);
+    if (index < lower || index > upper) {
+        ip = insnIP;                /* fault returns to BOUND */
+        performInterrupt(ep, INT5_BOUND);
+    }
+}
+
+static void opPushI(void)               /* PUSH iw, PUSH ib */
+{
+    push(opcode == 0x68 ? fetchWord() : signExtend(fetchByte()));
+}
+
+static void opIMulI(void)               /* IMUL rw,rmw,iv */
+{
+    long product;
+
+    wordSize = true;
+    source = (short)readEA();
+    product = (long)(short)source *
+        (opcode == 0x69 ? (short)fetchWord() : (short)signExtend(fetchByte()));
+    setReg(product);
+    setCF(product != (short)product);
+    setOF(cf());
+}
+
+static void opINS(void)
+{
+    wordSize = opcode & 1;
+    if (rep == 0 || cx() != 0)
+        stoS(portIn(dx(), wordSize));
+    doRep(false);
+}
+
+static void opOUTS(void)
+{
+    wordSize = opcode & 1;
+    if (rep == 0 || cx() != 0)
+        portOut(dx(), lodS(), wordSize);
+    doRep(false);
+}
+
+static void opENTER(void)
+{
+    Word size = fetchWord();
+    int level = fetchByte() & 0x1f;
+    Word frame;
+
+    push(bp());
+    frame = sp();
+    if (level > 0) {
+        while (--level > 0) {
+            setBP(bp() - 2);
+            push(readWord(bp(), SS));
+        }
+        push(frame);
+    }
+    setBP(frame);
+    setSP(sp() - size);
+}
+
+static void opLEAVE(void)
+{
+    setSP(bp());
+    setBP(pop());
+}
+
+#define ALU_OPS(n)                                                      \
+    [n+0] = opAluRMB, [n+1] = opAluRMW, [n+2] = opAluRB, [n+3] = opAluRW, \
+    [n+4] = opAluALI, [n+5] = opAluAXI
+
+static void (*opTable[256])(void) = {
+    ALU_OPS(0x00), ALU_OPS(0x08), ALU_OPS(0x10), ALU_OPS(0x18),
+    ALU_OPS(0x20), ALU_OPS(0x28), ALU_OPS(0x30), ALU_OPS(0x38),
+    [0x06] = opPushSeg, [0x0e] = opPushSeg, [0x16] = opPushSeg,
+    [0x1e] = opPushSeg,
+    [0x07] = opPopSeg, [0x17] = opPopSeg, [0x1f] = opPopSeg,
+    [0x0f] = opUndefined,                           /* POP CS */
+    [0x26] = opSegment, [0x2e] = opSegment, [0x36] = opSegment,
+    [0x3e] = opSegment,
+    [0x27] = opDAA, [0x2f] = opDAA,
+    [0x37] = opAAA, [0x3f] = opAAA,
+    [0x40 ... 0x4f] = opIncDecRW,
+    [0x50 ... 0x57] = opPushRW,
+    [0x58 ... 0x5f] = opPopRW,
+    [0x60 ... 0x6f] = opUndefined,                  /* 80186+ */
+    [0x70 ... 0x7f] = opJcond,
+    [0x80 ... 0x83] = opAluRMI,
+    [0x84 ... 0x85] = opTestRM,
+    [0x86 ... 0x87] = opXchgRM,
+    [0x88 ... 0x89] = opMovRMR,
+    [0x8a ... 0x8b] = opMovRRM,
+    [0x8c] = opMovRMSeg,
+    [0x8d] = opLEA,
+    [0x8e] = opMovSegRM,
+    [0x8f] = opPopRM,
+    [0x90 ... 0x97] = opXchgAX,
+    [0x98] = opCBW,
+    [0x99] = opCWD,
+    [0x9a] = opCallFar,
+    [0x9b] = opNop,                                 /* WAIT */
+    [0x9c] = opPUSHF,
+    [0x9d] = opPOPF,
+    [0x9e] = opSAHF,
+    [0x9f] = opLAHF,
+    [0xa0 ... 0xa1] = opMovAccMem,
+    [0xa2 ... 0xa3] = opMovMemAcc,
+    [0xa4 ... 0xa5] = opMOVS,
+    [0xa6 ... 0xa7] = opCMPS,
+    [0xa8 ... 0xa9] = opTestAcc,
+    [0xaa ... 0xab] = opSTOS,
+    [0xac ... 0xad] = opLODS,
+    [0xae ... 0xaf] = opSCAS,
+    [0xb0 ... 0xb7] = opMovRBI,
+    [0xb8 ... 0xbf] = opMovRWI,
+    [0xc0 ... 0xc1] = opUndefined,                  /* 80186+ */
+    [0xc2 ... 0xc3] = opRET,
+    [0xc4 ... 0xc5] = opLESLDS,
+    [0xc6 ... 0xc7] = opMovRMI,
+    [0xc8 ... 0xc9] = opUndefined,                  /* 80186+ */
+    [0xca ... 0xcb] = opRET,
+    [0xcc] = opINT3,
+    [0xcd] = opINT,
+    [0xce] = opINTO,
+    [0xcf] = opIRET,
+    [0xd0 ... 0xd3] = opRotate,
+    [0xd4] = opAAM,
+    [0xd5] = opAAD,
+    [0xd6] = opSALC,
+    [0xd7] = opXLATB,
+    [0xd8 ... 0xdf] = opUndefined,                  /* escape */
+    [0xe0 ... 0xe2] = opLOOP,
+    [0xe3] = opJCXZ,
+    [0xe4 ... 0xe5] = opInI,
+    [0xe6 ... 0xe7] = opOutI,
+    [0xe8] = opCallNear,
+    [0xe9] = opJmpNear,
+    [0xea] = opJmpFar,
+    [0xeb] = opJmpShort,
+    [0xec ... 0xed] = opInDX,
+    [0xee ... 0xef] = opOutDX,
+    [0xf0] = opNop,                                 /* LOCK */
+    [0xf1] = opUndefined,
+    [0xf2 ... 0xf3] = opREP,
+    [0xf4] = opHLT,
+    [0xf5] = opCMC,
+    [0xf6 ... 0xf7] = opMath,
+    [0xf8 ... 0xf9] = opSetCF,
+    [0xfa ... 0xfb] = opSetIF,
+    [0xfc ... 0xfd] = opSetDF,
+    [0xfe ... 0xff] = opMisc,
+};
+
+/* execute a single repetition of instruction */
+void executeInstruction(void)
+{
+    Word startIP = ip;
+    Word startCS = cs();
+
+    if (!timing)
+        cpuClock += INSN_CLOCKS;
+    insn.words = insn.oddWords = insn.length = 0;
+    traced = false;
+    if (!repeating) {
+        if (!prefix) {
+            segmentOverride = -1;
+            rep = 0;
+            insnIP = startIP;
+            traceCS = startCS;
+            traceIP = startIP;
+            traceLength = 0;
+            if (cpuClock >= nextEvent)
+                runEvents();
+            if (intShadow)
+                intShadow = false;
+            else if (irqPending && (flags & IF)) {
+                performInterrupt(ep, picAcknowledge());
+                if (tracing)
+                    traceDone(true);
+                if (timing) {
+                    insn.transfer = true;
+                    chargeInterrupt(&insn);
                 }
-                break;
+                return;
+            }
+            counters.instructions++;
+        }
+        prefix = false;
+        opcode = fetchByte();
+        if (rep != 0 && (opcode < 0xa4 || opcode >= 0xb0 || opcode == 0xa8 || opcode == 0xa9) &&
+            (opcode < 0x6c || opcode > 0x6f || cpuModel < CPU_186))
+            runtimeError("REP prefix with non-string instruction");
+    }
+    opTable[opcode]();
+    if (rep && !prefix)
+        counters.repIterations++;
+    if (tracing) {
+        traceLength += insn.length;
+        if (!prefix && !traced)
+            traceInstruction(traceCS, traceIP, traceLength, false);
+        if (!prefix)
+            traceLength = 0;
     }
+    if (timing) {
+        insn.opcode = opcode;
+        insn.modRM = modRM;
+        insn.memory = useMemory;
+        insn.rep = rep != 0;
+        insn.transfer = ip != (Word)(startIP + insn.length) || cs() != startCS;
+        chargeInstruction(&insn);
+    }
+}
+
+static const struct {
+    Byte opcode;
+    void (*fn)(void);
+} ops186[] = {
+    { 0x60, opPUSHA }, { 0x61, opPOPA }, { 0x62, opBOUND },
+    { 0x68, opPushI }, { 0x69, opIMulI }, { 0x6a, opPushI }, { 0x6b, opIMulI },
+    { 0x6c, opINS }, { 0x6d, opINS }, { 0x6e, opOUTS }, { 0x6f, opOUTS },
+    { 0xc0, opRotate }, { 0xc1, opRotate }, { 0xc8, opENTER }, { 0xc9, opLEAVE },
+};
+
+/* select processor model, 286 protected mode instructions are not emulated */
+void setCPU(int model)
+{
+    int i;
+
+    cpuModel = model;
+    for (i=0; i<sizeof(ops186)/sizeof(ops186[0]); i++)
+        opTable[ops186[i].opcode] = model >= CPU_186 ? ops186[i].fn : opUndefined;
+}
+
+int getCPU(void)
+{
+    return cpuModel;
 }
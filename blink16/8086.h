@@ -9,11 +9,29 @@ typedef uint32_t DWord;
 /* segment registers after 8 general registers */
 enum { ES = 0, CS, SS, DS };
 
+/*
+ * Register file: 8 general registers AX CX DX BX SP BP SI DI, then
+ * the 4 segment registers. The 8-bit registers AL CL DL BL AH CH DH BH
+ * overlay the first four words, their byte offsets fixed at build time
+ * by host byte order.
+ */
+union registerFile {
+    Word w[12];
+    Byte b[24];
+};
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REG_LOBYTE  1
+#else
+#define REG_LOBYTE  0
+#endif
+#define BYTEREG(r)  ((((r) & 3) << 1) | ((((r) >> 2) & 1) ^ REG_LOBYTE))
+
 /* emulator globals */
 #define RAMSIZE     0x100000    /* 1M RAM */
-extern Word registers[12];
-extern Byte* byteRegisters[8];
-extern Byte ram[RAMSIZE];
+#define MEMSIZE     (RAMSIZE + 0x10000) /* and the HMA, reached with A20 on */
+extern union registerFile regs;
+extern Byte ram[MEMSIZE];
 
 /* emulator operation */
 struct exe;                     /* defined in exe.h */
@@ -21,6 +39,14 @@ void initMachine(struct exe *e);
 void initExecute(void);
 void executeInstruction(void);
 bool isRepeating(void);
+bool inInstruction(void);
+
+/* processor models */
+#define CPU_8086    86
+#define CPU_186     186
+#define CPU_286     286
+void setCPU(int model);
+int getCPU(void);
 
 /* emulator callouts */
 void runtimeError(const char *msg, ...);
@@ -42,51 +68,74 @@ DWord physicalAddress(Word offset, int seg, int write);
 void setShadowFlags(Word offset, int seg, int len, int flags);
 void setShadowCheck(bool on);
 
+/* address line 20 gate, held off on an 8086 and 80186 */
+void setA20(bool on);
+bool getA20(void);
+DWord wrapA20(DWord a);
+
+/*
+ * changed memory tracking, a bit per 256 byte page, kept for each user:
+ * checkpoint.c takes DIRTY_CHECKPOINT, takeTextDirty takes DIRTY_TEXT
+ */
+#define DIRTYSHIFT  8
+#define DIRTYPAGES  (MEMSIZE >> DIRTYSHIFT)
+enum { DIRTY_CHECKPOINT, DIRTY_TEXT, DIRTYUSERS };
+void setDirty(DWord a, DWord len);
+bool takeDirty(int user, Byte dirty[DIRTYPAGES / 8]);
+bool testDirty(int user, DWord a, DWord len);
+
+/* text mode display memory tracking */
+#define TEXTCELLS   (80 * 25)
+bool textChanged(void);
+void setTextBase(DWord base);
+bool takeTextDirty(Byte dirty[TEXTCELLS / 8]);
+
 #define INT0_DIV_ERROR  0
 #define INT3_BREAKPOINT 3
 #define INT4_OVERFLOW   4
+#define INT5_BOUND      5
 
 /* register access functions */
-static inline Word ax() { return registers[0]; }
-static inline Word cx() { return registers[1]; }
-static inline Word dx() { return registers[2]; }
-static inline Word bx() { return registers[3]; }
-static inline Word sp() { return registers[4]; }
-static inline Word bp() { return registers[5]; }
-static inline Word si() { return registers[6]; }
-static inline Word di() { return registers[7]; }
-static inline Word es() { return registers[8]; }
-static inline Word cs() { return registers[9]; }
-static inline Word ss() { return registers[10]; }
-static inline Word ds() { return registers[11]; }
-static inline Byte al() { return *byteRegisters[0]; }
-static inline Byte cl() { return *byteRegisters[1]; }
-static inline Byte dl() { return *byteRegisters[2]; }
-static inline Byte bl() { return *byteRegisters[3]; }
-static inline Byte ah() { return *byteRegisters[4]; }
-static inline Byte ch() { return *byteRegisters[5]; }
-static inline Byte dh() { return *byteRegisters[6]; }
-static inline Byte bh() { return *byteRegisters[7]; }
-static inline void setAX(Word value) { registers[0] = value; }
-static inline void setCX(Word value) { registers[1] = value; }
-static inline void setDX(Word value) { registers[2] = value; }
-static inline void setBX(Word value) { registers[3] = value; }
-static inline void setSP(Word value) { registers[4] = value; }
-static inline void setBP(Word value) { registers[5] = value; }
-static inline void setSI(Word value) { registers[6] = value; }
-static inline void setDI(Word value) { registers[7] = value; }
-static inline void setES(Word value) { registers[8] = value; }
-static inline void setCS(Word value) { registers[9] = value; }
-static inline void setSS(Word value) { registers[10] = value; }
-static inline void setDS(Word value) { registers[11] = value; }
-static inline void setAL(Byte value) { *byteRegisters[0] = value; }
-static inline void setCL(Byte value) { *byteRegisters[1] = value; }
-static inline void setDL(Byte value) { *byteRegisters[2] = value; }
-static inline void setBL(Byte value) { *byteRegisters[3] = value; }
-static inline void setAH(Byte value) { *byteRegisters[4] = value; }
-static inline void setCH(Byte value) { *byteRegisters[5] = value; }
-static inline void setDH(Byte value) { *byteRegisters[6] = value; }
-static inline void setBH(Byte value) { *byteRegisters[7] = value; }
+static inline Word ax() { return regs.w[0]; }
+static inline Word cx() { return regs.w[1]; }
+static inline Word dx() { return regs.w[2]; }
+static inline Word bx() { return regs.w[3]; }
+static inline Word sp() { return regs.w[4]; }
+static inline Word bp() { return regs.w[5]; }
+static inline Word si() { return regs.w[6]; }
+static inline Word di() { return regs.w[7]; }
+static inline Word es() { return regs.w[8]; }
+static inline Word cs() { return regs.w[9]; }
+static inline Word ss() { return regs.w[10]; }
+static inline Word ds() { return regs.w[11]; }
+static inline Byte al() { return regs.b[BYTEREG(0)]; }
+static inline Byte cl() { return regs.b[BYTEREG(1)]; }
+static inline Byte dl() { return regs.b[BYTEREG(2)]; }
+static inline Byte bl() { return regs.b[BYTEREG(3)]; }
+static inline Byte ah() { return regs.b[BYTEREG(4)]; }
+static inline Byte ch() { return regs.b[BYTEREG(5)]; }
+static inline Byte dh() { return regs.b[BYTEREG(6)]; }
+static inline Byte bh() { return regs.b[BYTEREG(7)]; }
+static inline void setAX(Word value) { regs.w[0] = value; }
+static inline void setCX(Word value) { regs.w[1] = value; }
+static inline void setDX(Word value) { regs.w[2] = value; }
+static inline void setBX(Word value) { regs.w[3] = value; }
+static inline void setSP(Word value) { regs.w[4] = value; }
+static inline void setBP(Word value) { regs.w[5] = value; }
+static inline void setSI(Word value) { regs.w[6] = value; }
+static inline void setDI(Word value) { regs.w[7] = value; }
+static inline void setES(Word value) { regs.w[8] = value; }
+static inline void setCS(Word value) { regs.w[9] = value; }
+static inline void setSS(Word value) { regs.w[10] = value; }
+static inline void setDS(Word value) { regs.w[11] = value; }
+static inline void setAL(Byte value) { regs.b[BYTEREG(0)] = value; }
+static inline void setCL(Byte value) { regs.b[BYTEREG(1)] = value; }
+static inline void setDL(Byte value) { regs.b[BYTEREG(2)] = value; }
+static inline void setBL(Byte value) { regs.b[BYTEREG(3)] = value; }
+static inline void setAH(Byte value) { regs.b[BYTEREG(4)] = value; }
+static inline void setCH(Byte value) { regs.b[BYTEREG(5)] = value; }
+static inline void setDH(Byte value) { regs.b[BYTEREG(6)] = value; }
+static inline void setBH(Byte value) { regs.b[BYTEREG(7)] = value; }
 Word getIP(void);
 void setIP(Word w);
 void setFlags(Word w);
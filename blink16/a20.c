@@ -0,0 +1,79 @@
+/*
+ * A20 gate for 8086 emulator
+ *
+ * The gate is opened and closed through the fast A20 bit of port 92h
+ * or the output port of the 8042 keyboard controller at 60h and 64h,
+ * as on the PS/2 and AT. Only the controller commands that handle the
+ * gate are implemented, the keyboard itself isn't, and reset requests
+ * are ignored. The gate state is kept with the processor, which does
+ * the wrapping, and has an effect only when it models a 286.
+ */
+#include "8086.h"
+#include "devices.h"
+#include "portio.h"
+#include "checkpoint.h"
+
+#define STATUS_OBF      0x01    /* output buffer full */
+#define STATUS_SYS      0x04    /* system flag, POST passed */
+#define STATUS_UNLOCKED 0x10    /* keyboard not inhibited */
+#define OUTPUT_A20      0x02    /* output port and port 92h A20 bit */
+
+static struct {
+    uint8_t command;            /* awaiting a data byte at 60h */
+    uint8_t data;               /* next byte read at 60h */
+    bool full;
+} kbc;
+
+void initA20(void)
+{
+    kbc.command = 0;
+    kbc.data = 0;
+    kbc.full = false;
+    registerPorts(0x60, 1, kbcRead, kbcWrite);
+    registerPorts(0x64, 1, kbcRead, kbcWrite);
+    registerPorts(0x92, 1, a20Read, a20Write);
+    addState(&kbc, sizeof(kbc));
+}
+
+uint8_t kbcRead(uint16_t port)
+{
+    if (port == 0x64)
+        return STATUS_SYS | STATUS_UNLOCKED | (kbc.full ? STATUS_OBF : 0);
+    kbc.full = false;
+    return kbc.data;
+}
+
+void kbcWrite(uint16_t port, uint8_t value)
+{
+    if (port == 0x60) {
+        if (kbc.command == 0xd1)        /* write output port */
+            setA20(value & OUTPUT_A20);
+        kbc.command = 0;
+        return;
+    }
+    switch (value) {
+    case 0xd0:                          /* read output port */
+        kbc.data = 0xdd | (getA20() ? OUTPUT_A20 : 0);
+        kbc.full = true;
+        break;
+    case 0xd1:
+        kbc.command = value;
+        break;
+    case 0xdd:                          /* A20 off */
+        setA20(false);
+        break;
+    case 0xdf:                          /* A20 on */
+        setA20(true);
+        break;
+    }
+}
+
+uint8_t a20Read(uint16_t port)
+{
+    return getA20() ? OUTPUT_A20 : 0;
+}
+
+void a20Write(uint16_t port, uint8_t value)
+{
+    setA20(value & OUTPUT_A20);
+}
@@ -0,0 +1,26 @@
+#!/bin/sh
+#
+# Run blink16 benchmarks headless, printing one JSON object per line
+# with the counters that track emulator throughput. Instructions per
+# second count each REP iteration as an instruction, so string heavy
+# programs compare with the rest.
+#
+# Usage: bench/bench.sh ./blink16 o/bench/alu.com ...
+#
+# The --stats JSON for each is left beside its .com file.
+#
+blink16=$1
+shift
+for com in "$@"; do
+    name=$(basename "$com" .com)
+    json=${com%.com}.json
+    "$blink16" -t --stats "$json" "$com" > /dev/null || exit 1
+    awk -v name="$name" '
+        { gsub(/[",]/, ""); v[$1] = $2 }
+        END {
+            ops = v["instructions:"] + v["rep_iterations:"]
+            cpu = v["cpu_seconds:"]
+            printf "{\"bench\": \"%s\", \"instructions\": %.0f, \"rep_iterations\": %.0f, ", name, v["instructions:"], v["rep_iterations:"]
+            printf "\"cpu_seconds\": %s, \"ips\": %.0f}\n", cpu, (cpu > 0 ? ops / cpu : 0)
+        }' "$json"
+done
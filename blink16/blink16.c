@@ -14,6 +14,13 @@
 #include "blink/util.h"
 
 #include "8086.h"
+#include "timing.h"
+#include "checkpoint.h"
+#include "trace.h"
+#include "counters.h"
+#include "extmem.h"
+#include "gdbstub.h"
+#include "strace.h"
 #include "disasm.h"
 #include "discolor.h"
 #include "syms.h"
@@ -30,6 +37,8 @@ void runtimeError(const char *msg, ...)
     vfprintf(stderr, msg, args);
     va_end(args);
     fprintf(stderr, "\nCS:IP = %04x:%04x\n", cs(), getIP());
+    if (gdbAttached)
+        gdbFault();
     exit(1);
 }
 
@@ -49,7 +58,7 @@ void SetWriteAddr(struct Machine *m, i64 addr, u32 size) {
 
 u8 *LookupAddress(struct Machine *m, i64 virt)
 {
-    if (virt < 0 || virt >= RAMSIZE)
+    if (virt < 0 || virt >= MEMSIZE)
         return 0;
     return ram + virt;
 }
@@ -58,13 +67,14 @@ static int nextbyte_mem(int cs, int ip)
 {
     unsigned int offset = (cs << 4) + ip;
 
-    if (offset >= RAMSIZE) return 0;
-    return ram[offset] & 0xff;
+    if (offset >= MEMSIZE) return 0;
+    return ram[wrapA20(offset)] & 0xff;
 }
 
 long Dis(struct Dis *d, struct Machine *m, i64 addr, i64 ip, int lines)
 {
     int i, nextip;
+    bool far;
 
     d->m = m;
     if (lines > d->ops.n) {
@@ -89,8 +99,10 @@ long Dis(struct Dis *d, struct Machine *m, i64 addr, i64 ip, int lines)
     d->ops.i = lines;
     nextip = ip;
     dis8086.e = &exe8086;
+    far = exe8086.ftextseg && cs() == exe8086.ftextseg;
     for (i=0; i<lines; i++) {
-        addr_t fnstart = sym_fn_start_address(&exe8086, nextip); //FIXME seg needed
+        addr_t fnstart = far? sym_ftext_fn_start_address(&exe8086, nextip):
+                              sym_fn_start_address(&exe8086, nextip);
         if (d->ops.p[i].s) {
             free(d->ops.p[i].s);
             d->ops.p[i].s = 0;
@@ -104,7 +116,8 @@ long Dis(struct Dis *d, struct Machine *m, i64 addr, i64 ip, int lines)
             if (!(d->noraw & 4)) p += sprintf(p, "%04hx ", (unsigned short)nextip);
             if (d->noraw & 8) p += sprintf(p, "           ");
             p = highStart(p, g_high.label);
-            p = stpcpy(p, sym_text_symbol(&exe8086, nextip, 1));
+            p = stpcpy(p, far? sym_ftext_symbol(&exe8086, nextip, 1):
+                               sym_text_symbol(&exe8086, nextip, 1));
             p = highEnd(p);
             *p++ = ':';
             *p = '\0';
@@ -191,8 +204,11 @@ extern bool tuimode;
 bool OnHalt(int interrupt)
 {
     bool ret;
+    struct timer t;
     copyRegistersFromVM(g_machine);
+    t = enterTimer(TIME_BIOS);
     ret = OnHalt2(interrupt);
+    leaveTimer(t);
     copyRegistersToVM(g_machine);
     return ret;
 }
@@ -203,6 +219,11 @@ bool canHandleInterrupt(struct exe *e, int intno)
     case 0x80:      // ELKS syscall
     case 0x21:      // DOS syscall
         return !g_machine->metal;
+    case 0x2f:      // DOS multiplex, XMS
+    case 0x67:      // EMS
+    case INT_XMS:   // XMS driver
+        return !g_machine->metal && e->handleSyscall == handleSyscallDOS &&
+            isExtendedMemoryInterrupt(intno);
     case 0:         // HW divide
     case 3:         // HW INT 3
     case 4:         // HW INTO
@@ -234,12 +255,26 @@ bool handleInterrupt(struct exe *e, int intno)
 
     if (!g_machine->metal && (intno == 0x80 || intno == 0x21)) {
         bool old = tuimode;
+        struct timer t;
         tuimode = true;
-        g_machine->system->redraw(true);
+        g_machine->system->redraw(false);   /* at most once per frame */
+        if (tracingSyscalls)
+            traceSyscallEntry(intno);
+        t = enterTimer(TIME_SYSCALL);
         if (e->handleSyscall(e, intno))
             tuimode = old;  /* old tuimode on success */
+        leaveTimer(t);
+        if (tracingSyscalls)
+            traceSyscallExit();
         return 1;
     }
+    counters.biosInterrupts[intno & 0xff]++;
+    if (!g_machine->metal && isExtendedMemoryInterrupt(intno)) {
+        struct timer t = enterTimer(TIME_BIOS);
+        bool ret = handleExtendedMemory(intno);
+        leaveTimer(t);
+        return ret;
+    }
 
     switch (intno) {
     case kMachineUndefinedInstruction:
@@ -279,16 +314,20 @@ void LoadProgram(struct Machine *m, char *prog, char **args, char **vars)
     } else {
         loadExecutableElks(&exe8086, prog, ac, args, vars);
         sym_read_exe_symbols(&exe8086, prog);
-        exe8086.textseg = cs();
-        exe8086.dataseg = ds();
         m->system->codestart = cs() << 4;
         m->system->codesize = exe8086.aout.tseg;
+        if (exe8086.ftextseg)           /* far text follows text */
+            m->system->codesize = ((exe8086.ftextseg - exe8086.textseg) << 4) +
+                exe8086.eshdr.esh_ftseg;
     }
 
     copyRegistersFromVM(m);
     m->cs.base = (m->cs.sel = cs()) << 4;
     m->ip = getIP();
     initExecute();
+    resetCheckpoints();
+    if (tracing)
+        traceProgram(exe8086.textseg, exe8086.ftextseg, exe8086.dataseg);
 }
 
 struct System *NewSystem(void)
@@ -351,7 +390,10 @@ void LoadInstruction(struct Machine *m, u64 pc)
 void ExecuteInstruction(struct Machine *m)
 {
     bool repeating;
+    i64 pc = GetPc(m);
+    Clock start = cycles;
     extern void ProfileOp(struct Machine *m, u64 pc);
+    extern void ProfileCycles(struct Machine *m, u64 pc, u64 n);
 
     //disasm(&dis8086, cs(), m->ip, nextbyte_mem, ds(), 0);
     //m->ip += dis8086.oplen;
@@ -362,10 +404,33 @@ void ExecuteInstruction(struct Machine *m)
         if (repeating)
             ProfileOp(m, GetPc(m));
     } while (repeating);
+    if (timing)
+        ProfileCycles(m, pc, cycles - start);
     m->oplen = getIP() - m->ip;
     if (!isRepeating())
         m->ip = getIP();
     copyRegistersFromVM(m);
+    if (cpuClock >= nextCheckpoint && !inInstruction())
+        takeCheckpoint();
+}
+
+/* restore the newest checkpoint before clock when, false if none */
+bool RewindMachine(struct Machine *m, Clock when)
+{
+    if (!rewindBefore(when))
+        return false;
+    copyRegistersFromVM(m);
+    m->ip = getIP();
+    m->oplen = 0;
+    return true;
+}
+
+/* stop for GDB, which may change registers and memory */
+void GdbStop(struct Machine *m)
+{
+    gdbStop();
+    copyRegistersFromVM(m);
+    m->ip = getIP();
 }
 
 i64 GetPc(struct Machine *m)
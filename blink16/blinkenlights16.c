@@ -80,6 +80,16 @@
 
 #if BLINK16
 #include "8086.h"
+#include "devices.h"
+#include "timing.h"
+#include "replay.h"
+#include "checkpoint.h"
+#include "trace.h"
+#include "counters.h"
+#include "extmem.h"
+#include "gdbstub.h"
+#include "condition.h"
+#include "strace.h"
 #include "exe.h"            //FIXME remove if possible
 #include "syms.h"           //FIXME remove if possible
 extern struct exe exe8086;  //FIXME remove if possible
@@ -98,13 +108,27 @@ FLAGS\n\
   -z        zoom\n\
   -v        verbosity\n\
   -r        real mode\n\
-  -s        statistics\n\
+  -s        statistics, also on SIGUSR1\n\
   -H        disable highlight\n\
   -t        disable tui mode\n\
   -R        disable reactive\n\
-  -b ADDR   push a breakpoint\n\
+  -b ADDR   push a breakpoint, ADDR may be followed by after N, to pass\n\
+            over N hits, and if EXPR, to stop only when EXPR is nonzero\n\
   -w ADDR   push a watchpoint\n\
   -L PATH   log file location\n\
+  -m CPU    processor model: 8086 (default), 8088, 186 or 286\n\
+  -c        estimate 8086/8088 clock cycles\n\
+  -1 DEV    attach COM1 to DEV (- for stdio, pty, or path)\n\
+  -2 DEV    attach COM2 to DEV\n\
+  --record PATH  record nondeterministic inputs to PATH\n\
+  --replay PATH  re-execute a run recorded to PATH\n\
+  --rewind MB    memory for reverse execution checkpoints (64, 0 off)\n\
+  --trace PATH   write binary execution trace to PATH, see tracedump\n\
+  --stats PATH   write statistics to PATH as JSON\n\
+  --xms MB       extended memory for DOS programs (0-63, 0 off)\n\
+  --ems MB       expanded memory for DOS programs (0-32, 0 off)\n\
+  --gdb [HOST]:PORT|PATH  debug with gdb over tcp or a unix socket\n\
+  --trace-syscalls PATH|FD  trace ELKS and DOS system calls to PATH or FD\n\
 \n\
 ARGUMENTS\n\
 \n\
@@ -134,10 +158,12 @@ f       finish                    -R       deliver crash sigs\n\
 R       restart                   -H       disable highlighting\n\
 x       hex                       -v       increase verbosity\n\
 ?       help                      -j       enables jit\n\
-t       sse type                  -m       disables memory safety\n\
+t       sse type                  -m CPU   8086, 186 or 286\n\
 w       sse width                 -N       natural scroll wheel\n\
 B       pop breakpoint            -?       help\n\
-p       profiling mode\n\
+p       profiling mode            -c       cycle timing\n\
+b       step back\n\
+r       reverse continue\n\
 ctrl-t  turbo\n\
 alt-t   slowmo"
 
@@ -149,6 +175,7 @@ alt-t   slowmo"
 #define DISPWIDTH  80     // size of the embedded tty display
 #define DUMPWIDTH  64     // columns of bytes in memory panel
 #define ASMWIDTH   40     // seed the width of assembly panel
+#define CONSOLEBUF 4096   // guest console output coalescing buffer
 #define ASMRAWMIN  (m->mode == XED_MODE_REAL ? 50 : 65)
 
 #define RESTART  0x001
@@ -163,6 +190,7 @@ alt-t   slowmo"
 #define QUIT     0x200
 #define EXIT     0x400
 #define ALARM    0x800
+#define STATS    0x1000
 
 #define kXmmDecimal 0
 #define kXmmHex     1
@@ -274,6 +302,7 @@ struct ProfSym {
 #if BLINK16
   char *name;
   u16 addr;
+  u64 cycles;
 #else
   int sym;  // dis->syms.p[sym]
 #endif
@@ -283,9 +312,22 @@ struct ProfSym {
 struct ProfSyms {
   int i, n;
   unsigned long toto;
+  u64 cyclestoto;
   struct ProfSym *p;
 };
 
+struct BreakCondition {  // for breakpoints.p[i] at the same index
+  u32 hits;                // times reached with cond true
+  u32 ignore;              // hits to pass over before stopping
+  struct condition *cond;  // stop only when true, or null
+};
+
+struct BreakConditions {
+  int n;
+  bool nocount;  // re-executing, leave hit counts alone
+  struct BreakCondition *p;
+};
+
 static const char kRipName[3][4] = {"IP", "EIP", "RIP"};
 
 static const char kRegisterNames[3][16][4] = {
@@ -346,11 +388,14 @@ static const char *dialog;
 static char *statusmessage;
 static i64 breakpointsstart;
 static unsigned long *ophits;
+static u64 *opcycles;
+static bool bus8;
 static struct ProfSyms profsyms;
 
 static struct Panels pan;
 static struct Keystrokes keystrokes;
 static struct Breakpoints breakpoints;
+static struct BreakConditions breakconds;
 static struct Watchpoints watchpoints;
 static struct MemoryView codeview;
 static struct MemoryView readview;
@@ -362,6 +407,7 @@ static struct XmmType xmmtype;
 static struct Dis dis[1];
 
 static struct timespec last_draw;
+static struct timespec last_frame;
 static struct timespec statusexpires;
 static struct termios oldterm;
 static char systemfailure[128];
@@ -369,7 +415,22 @@ static struct sigaction oldsig[4];
 static char pathbuf[PATH_MAX];
 struct History g_history;
 
+static struct TextCell {  /* encoded CGA text cell */
+  u8 attr;
+  u8 len;
+  char glyph[3];
+} textcells[25][80];
+static struct Buffer textrows[25];
+
+static struct Console {   /* guest output not yet written to the pty */
+  size_t i;
+  bool redraw;            /* display is stale, redraw on next frame */
+  char p[CONSOLEBUF];
+} console;
+
 static void Redraw(bool);
+static void FlushConsole(void);
+static void ConsoleRedraw(bool);
 static void SetupDraw(void);
 static void HandleKeyboard(const char *);
 
@@ -535,6 +596,11 @@ static void AppendPanel(struct Panel *p, i64 line, const char *s) {
 static int CompareProfSyms(const void *p, const void *q) {
   const struct ProfSym *a = (const struct ProfSym *)p;
   const struct ProfSym *b = (const struct ProfSym *)q;
+  if (timing) {
+    if (a->cycles > b->cycles) return -1;
+    if (a->cycles < b->cycles) return +1;
+    return 0;
+  }
   if (a->hits > b->hits) return -1;
   if (a->hits < b->hits) return +1;
   return 0;
@@ -544,7 +610,7 @@ static void SortProfSyms(void) {
   qsort(profsyms.p, profsyms.i, sizeof(*profsyms.p), CompareProfSyms);
 }
 
-static int AddProfSym(char *sym, u16 addr, unsigned long hits) {
+static int AddProfSym(char *sym, u16 addr, unsigned long hits, u64 cycles) {
   if (!hits) return -1;
   if (profsyms.i == profsyms.n) {
     profsyms.p = (struct ProfSym *)realloc(profsyms.p,
@@ -553,6 +619,7 @@ static int AddProfSym(char *sym, u16 addr, unsigned long hits) {
   profsyms.p[profsyms.i].name = sym;
   profsyms.p[profsyms.i].addr = addr;
   profsyms.p[profsyms.i].hits = hits;
+  profsyms.p[profsyms.i].cycles = cycles;
   return profsyms.i++;
 }
 
@@ -566,13 +633,29 @@ static unsigned long TallyHits(i64 addr, int size) {
   return hits;
 }
 
+static u64 TallyCycles(i64 addr, int size) {
+  i64 pc;
+  u64 cycles;
+  if (!opcycles) return 0;
+  for (cycles = 0, pc = addr; pc < addr + size; ++pc) {
+    cycles += opcycles[pc - m->system->codestart];
+  }
+  return cycles;
+}
+
 static void GenerateProfile(void) {
   int sym;
   profsyms.i = 0;
   if (!ophits) return;  // FIXME PR
+#if BLINK16
+  if (m->cs.sel != m->system->codestart >> 4 &&
+      (!exe8086.ftextseg || m->cs.sel != exe8086.ftextseg)) return;
+#else
   if (m->cs.sel != m->system->codestart >> 4) return;
+#endif
   profsyms.toto = TallyHits(m->system->codestart, m->system->codesize);
 #if BLINK16
+  profsyms.cyclestoto = TallyCycles(m->system->codestart, m->system->codesize);
   u16 size, addr;
   unsigned char *p, *q;
   char *name;
@@ -587,7 +670,18 @@ static void GenerateProfile(void) {
     pn += symLen(p);
     *pn++ = '\0';
     //LOGF("sym %s addr %04x size %d\n", name, (unsigned)addr, (int)size);
-    AddProfSym(name, addr, TallyHits(m->cs.base + addr, size));
+    AddProfSym(name, addr, TallyHits(m->system->codestart + addr, size),
+               TallyCycles(m->system->codestart + addr, size));
+  }
+  for (p = sym_next_ftext_entry(&exe8086, NULL); p; p = q) {
+    q = sym_next_ftext_entry(&exe8086, p);
+    addr = symAddr(p);
+    size = q? symAddr(q) - addr: exe8086.eshdr.esh_ftseg - addr;
+    name = strncpy(pn, symName(p), symLen(p));
+    pn += symLen(p);
+    *pn++ = '\0';
+    AddProfSym(name, addr, TallyHits((exe8086.ftextseg << 4) + addr, size),
+               TallyCycles((exe8086.ftextseg << 4) + addr, size));
   }
 #else
   for (sym = 0; sym < dis->syms.i; ++sym) {
@@ -607,8 +701,15 @@ static void DrawProfile(struct Panel *p) {
   char line[256];
   GenerateProfile();
   for (i = 0; i < profsyms.i; ++i) {
-    snprintf(line, sizeof(line), "%04x %7.3f%% %s", profsyms.p[i].addr,
-        (double)profsyms.p[i].hits / profsyms.toto * 100, profsyms.p[i].name);
+    if (timing) {
+      snprintf(line, sizeof(line), "%04x %7.3f%% %7.3f%% %s", profsyms.p[i].addr,
+          (double)profsyms.p[i].hits / profsyms.toto * 100,
+          (double)profsyms.p[i].cycles / profsyms.cyclestoto * 100,
+          profsyms.p[i].name);
+    } else {
+      snprintf(line, sizeof(line), "%04x %7.3f%% %s", profsyms.p[i].addr,
+          (double)profsyms.p[i].hits / profsyms.toto * 100, profsyms.p[i].name);
+    }
     AppendPanel(p, i - framesstart, line);
   }
 }
@@ -809,6 +910,10 @@ static void OnSigAlrm(int sig, siginfo_t *si, void *uc) {
   action |= ALARM;
 }
 
+static void OnSigUsr1(int sig, siginfo_t *si, void *uc) {
+  action |= STATS;
+}
+
 static void OnSigCont(int sig, siginfo_t *si, void *uc) {
   if (tuimode) {
     TuiRejuvinate();
@@ -879,13 +984,51 @@ static void ResolveWatchpoints(void) {
 }
 #endif
 
+// pushes a breakpoint that stops after ignore hits when cond is true
+static ssize_t PushBreakpoint2(struct Breakpoint *b, u32 ignore,
+                               struct condition *cond) {
+  ssize_t i = PushBreakpoint(&breakpoints, b);
+  if (i >= breakconds.n) {
+    unassert((breakconds.p = realloc(breakconds.p,
+                                     breakpoints.n * sizeof(*breakconds.p))));
+    memset(breakconds.p + breakconds.n, 0,
+           (breakpoints.n - breakconds.n) * sizeof(*breakconds.p));
+    breakconds.n = breakpoints.n;
+  }
+  free(breakconds.p[i].cond);
+  breakconds.p[i].hits = 0;
+  breakconds.p[i].ignore = ignore;
+  breakconds.p[i].cond = cond;
+  return i;
+}
+
+// IsAtBreakpoint, passing over those whose condition or count says go on
+static ssize_t IsAtBreakpoint2(u16 seg, i64 addr) {
+  int i;
+  struct Breakpoint *b;
+  struct BreakCondition *c;
+  for (i = breakpoints.i; i--;) {
+    b = &breakpoints.p[i];
+    c = &breakconds.p[i];
+    if (b->disable || b->seg != seg || b->addr != addr) continue;
+    if (c->cond && !testCondition(c->cond)) continue;
+    if (!breakconds.nocount && c->hits++ < c->ignore) continue;
+    if (b->oneshot) {
+      b->disable = true;
+      if (i == breakpoints.i - 1) --breakpoints.i;
+    }
+    return i;
+  }
+  return -1;
+}
+
 static void BreakAtNextInstruction(void) {
   struct Breakpoint b;
   memset(&b, 0, sizeof(b));
   b.addr = GetPc(m) + /* m->xedd->length */ + m->oplen;
   b.seg = m->cs.sel;
   b.oneshot = true;
-  PushBreakpoint(&breakpoints, &b);
+  PushBreakpoint2(&b, 0, NULL);
   LOGF("set Breakpoint at %08x\n", (int)b.addr);
 }
 
@@ -1382,6 +1525,47 @@ static void DrawTerminal(struct Panel *p) {
   }
 }
 
+// re-encodes only the text cells on pages the guest wrote since the
+// last frame, then rebuilds the rows containing them. unchanged rows are
+// copied to the panel as is.
+static void DrawCgaText(struct Panel *p, u8 v[25][80][2]) {
+  u64 w;
+  u8 dirty[TEXTCELLS / 8];
+  char buf[11];
+  unsigned y, x, i, a, n;
+  struct TextCell *c;
+  if (takeTextDirty(dirty)) {
+    for (y = 0; y < 25; ++y) {
+      for (n = x = 0; x < 80; ++x) {
+        i = y * 80 + x;
+        if (!(dirty[i >> 3] & (1 << (i & 7)))) continue;
+        c = &textcells[y][x];
+        c->attr = v[y][x][1];
+        w = tpenc(kCp437[v[y][x][0]]);
+        c->len = 0;
+        do {
+          c->glyph[c->len++] = w;
+        } while ((w >>= 8));
+        ++n;
+      }
+      if (!n) continue;
+      textrows[y].i = 0;
+      for (a = -1, x = 0; x < 80; ++x) {
+        c = &textcells[y][x];
+        if (c->attr != a) {
+          AppendData(&textrows[y], buf, FormatCga((a = c->attr), buf));
+        }
+        AppendData(&textrows[y], c->glyph, c->len);
+      }
+      AppendStr(&textrows[y], "\033[0m");
+    }
+  }
+  n = MIN(25, p->bottom - p->top);
+  for (y = 0; y < n; ++y) {
+    AppendData(&p->lines[y], textrows[y].p, textrows[y].i);
+  }
+}
+
 static void DrawDisplay(struct Panel *p) {
   switch (vidya) {
     case 7:
@@ -1391,7 +1575,7 @@ static void DrawDisplay(struct Panel *p) {
     case 2:
     case 3:
       DrawHr(&pan.displayhr, "COLOR GRAPHICS ADAPTER");
-      DrawCga(p, (u8(*)[80][2])(m->system->real + 0xb8000));
+      DrawCgaText(p, (u8(*)[80][2])(m->system->real + 0xb8000));
       break;
     default:
       DrawTerminalHr(&pan.displayhr);
@@ -2012,6 +2196,7 @@ static const char *DescribeAction(void) {
   if (action & QUIT) p = stpcpy(p, "|QUIT");
   if (action & EXIT) p = stpcpy(p, "|EXIT");
   if (action & ALARM) p = stpcpy(p, "|ALARM");
+  if (action & STATS) p = stpcpy(p, "|STATS");
   return buf + !!buf[0];
 }
 
@@ -2062,6 +2247,9 @@ static void DrawStatus(struct Panel *p) {
   memset(s, 0, sizeof(*s));
   rw += AppendStr(s, DescribeAction());
   rw += AppendStat(s, 12, "ips", ips, false);
+#if BLINK16
+  if (timing) rw += AppendStat(s, 16, "cycles", cycles, false);
+#endif
   toto = kRealSize + (long)m->system->memstat.allocated * 4096;
   rw += AppendStat(s, 10, "kb", toto / 1024, false);
   //if (m->nolinear) rw += AppendStat(s, 8, "reserve", MEMSTAT(reserved));
@@ -2175,14 +2363,15 @@ static void ShowHistory(void) {
   free(ansi);
 }
 
-static void Redraw(bool force) {
+static void Redraw2(bool force) {
   int i, j;
   char *ansi;
   size_t size;
   double execsecs;
   struct timespec start_draw, end_draw;
   //if (!tuimode) return;   // FIXME PR?
-  if (displayexec) return;
+  FlushConsole();
+  if (displayexec || ttyout == -1) return;
   if (g_history.viewing) {
     ShowHistory();
     return;
@@ -2243,11 +2432,20 @@ static void Redraw(bool force) {
                     ToMicroseconds(SubtractTime(end_draw, start_draw))));
   if (force || PreventBufferbloat()) {
     unassert(UninterruptibleWrite(ttyout, ansi, size) != -1);
+    counters.redraws++;
+    counters.redrawBytes += size;
   }
   AddHistory(ansi, size);
   free(ansi);
   last_cycle = cycle;
-  last_draw = GetTime();
+  last_frame = last_draw = GetTime();
+  console.redraw = false;
+}
+
+static void Redraw(bool force) {
+  struct timer t = enterTimer(TIME_DISPLAY);
+  Redraw2(force);
+  leaveTimer(t);
 }
 
 static void ReactiveDraw(void) {
@@ -2376,6 +2574,9 @@ static ssize_t ReadAnsi(int fd, char *p, size_t n) {
   for (;;) {
     LOGF("%" PRIx64 " %s ReadAnsi", GetPc(m), tuimode ? "TUI" : "EXEC");
     readingteletype = true;
+    if (console.redraw) {
+      ConsoleRedraw(true);
+    }
     ReactiveDraw();
     rc = readansi(fd, p, n);
     readingteletype = false;
@@ -2489,6 +2690,7 @@ static int OnPtyFdPoll(struct pollfd *fds, nfds_t nfds, int ms) {
 static void DrawDisplayOnly(struct Panel *p) {
   struct Buffer b;
   int i, y, yn, xn, tly, tlx;
+  FlushConsole();
   yn = MIN(tyn, p->bottom - p->top);
   xn = MIN(txn, p->right - p->left);
   for (i = 0; i < yn; ++i) {
@@ -2512,15 +2714,83 @@ static void DrawDisplayOnly(struct Panel *p) {
   }
   UninterruptibleWrite(ttyout, b.p, b.i);
   free(b.p);
+  last_frame = GetTime();
+  console.redraw = false;
+}
+
+static void FlushConsole(void) {
+  if (!console.i) return;
+  if (ttyout == -1) {
+    UninterruptibleWrite(1, console.p, console.i);
+  } else {
+    PtyWrite(pty, console.p, console.i);
+  }
+  console.i = 0;
+}
+
+// coalesces guest output, which arrives a character at a time from
+// BIOS teletype output and unbuffered ELKS/DOS programs, so the pty
+// parses it in runs that end at a newline or when the buffer fills.
+static void ConsoleWrite(const char *s, size_t n) {
+  counters.outputBytes += n;
+  if (console.i + n > sizeof(console.p)) {
+    FlushConsole();
+    if (n > sizeof(console.p)) {
+      // too big to buffer, write through
+      if (ttyout == -1) {
+        UninterruptibleWrite(1, s, n);
+      } else {
+        PtyWrite(pty, s, n);
+      }
+      return;
+    }
+  }
+  memcpy(console.p + console.i, s, n);
+  console.i += n;
+  if (memchr(s, '\n', n)) {
+    FlushConsole();
+  }
+}
+
+// redraws the display after guest output, but no more often than the
+// tty frame rate. when a frame is skipped the redraw is left pending,
+// and is picked up by the periodic check in Exec(), a keyboard read,
+// or the next redraw, whichever comes first.
+static void ConsoleRedraw2(bool force) {
+  struct timespec now;
+  FlushConsole();
+  if (ttyout == -1) return;
+  now = GetTime();
+  if (!force && CompareTime(SubtractTime(now, last_frame),
+                            FromMicroseconds(1. / FPS * 1e6)) < 0) {
+    console.redraw = true;
+    return;
+  }
+  if (displayexec) {
+    DrawDisplayOnly(&pan.display);
+  } else {
+    Redraw(true);
+  }
+}
+
+static void ConsoleRedraw(bool force) {
+  struct timer t = enterTimer(TIME_DISPLAY);
+  ConsoleRedraw2(force);
+  leaveTimer(t);
 }
 
 ssize_t ptyWrite(int fd, char *buf, int len) {
-    return PtyWrite(pty, buf, len);
+  if (ttyout == -1 && fd > 2) {
+    return write(fd, buf, len);
+  }
+  ConsoleWrite(buf, len);
+  return len;
 }
 
 static ssize_t OnPtyFdWritev(int fd, const struct iovec *iov, int iovlen) {
   int i;
   size_t size;
+  FlushConsole();
   for (size = i = 0; i < iovlen; ++i) {
     PtyWrite(pty, iov[i].iov_base, iov[i].iov_len);
     size += iov[i].iov_len;
@@ -2799,10 +3069,16 @@ static void OnDiskServiceReadWriteSectors(bool write) {
       LOGF("bios read/write to ES:BX %04x:%04x", (unsigned)m->es.sel, Get16(m->bx));
       if (write) {
         SetReadAddr(m, addr, size);
-        memcpy(m->system->elf.map + offset, m->system->real + addr, size);
+        if (!replaying)   // leave the image as it was recorded against
+          memcpy(m->system->elf.map + offset, m->system->real + addr, size);
+        counters.sectorsWritten += sectors;
       } else {
         SetWriteAddr(m, addr, size);
-        memcpy(m->system->real + addr, m->system->elf.map + offset, size);
+        setDirty(addr, size);
+        if (!replaying)
+          memcpy(m->system->real + addr, m->system->elf.map + offset, size);
+        replayMemory(m->system->real + addr, size);
+        counters.sectorsRead += sectors;
       }
       m->ah = 0x00;     // no error
       SetCarry(false);
@@ -2866,16 +3142,22 @@ static void OnDiskServiceReadSectorsExtended(void) {
       LOGF("bios read sector failed 0 <= %" PRId64 " && %" PRIx64 " <= %lx",
            lba, offset, m->system->elf.mapsize);
       SetWriteAddr(m, pkt_addr + 2, 2);
+      setDirty(pkt_addr + 2, 2);
       Write16(pkt + 2, 0);
       m->ah = 0x0d;
     } else if (addr >= kRealSize || addr + size > kRealSize) {
       SetWriteAddr(m, pkt_addr + 2, 2);
+      setDirty(pkt_addr + 2, 2);
       Write16(pkt + 2, 0);
       m->ah = 0x02;
       SetCarry(true);
     } else {
       SetWriteAddr(m, addr, size);
-      memcpy(m->system->real + addr, m->system->elf.map + offset, size);
+      setDirty(addr, size);
+      if (!replaying)
+        memcpy(m->system->real + addr, m->system->elf.map + offset, size);
+      replayMemory(m->system->real + addr, size);
+      counters.sectorsRead += sectors;
       m->ah = 0x00;
       SetCarry(false);
     }
@@ -2909,6 +3191,7 @@ static void OnDiskService(void) {
 static void OnVidyaServiceSetMode(void) {
   if (LookupAddress(m, 0xB0000)) {
     vidya = m->al;
+    setTextBase(vidya == 7 ? 0xB0000 : 0xB8000);
   } else {
     LOGF("maybe you forgot -r flag");
   }
@@ -2921,13 +3204,18 @@ static void OnVidyaServiceGetMode(void) {
 }
 
 static void OnVidyaServiceSetCursorPosition(void) {
+  FlushConsole();
   PtySetY(pty, m->dh);
   PtySetX(pty, m->dl);
 }
 
 static void OnVidyaServiceGetCursorPosition(void) {
-  m->dh = pty->y;
-  m->dl = pty->x;
+  long pos;
+  FlushConsole();
+  // the display isn't rewound, so re-execution takes the logged position
+  pos = HOSTCALL(pty->y << 8 | pty->x);
+  m->dh = pos >> 8;
+  m->dl = pos;
   m->ch = 5;  // cursor ▂ scan lines 5..7 of 0..7
   m->cl = 7 | !!(pty->conf & kPtyNocursor) << 5;
 }
@@ -2960,7 +3248,7 @@ static void OnVidyaServiceWriteCharacter(void) {
   } while ((w >>= 8));
   p = stpcpy(p, "\0338");
   for (i = Get16(m->cx); i--;) {
-    PtyWrite(pty, buf, p - buf);
+    ConsoleWrite(buf, p - buf);
   }
 }
 
@@ -2986,7 +3274,7 @@ static void OnVidyaServiceTeletypeOutput(void) {
   do {
     buf[n++] = w;
   } while ((w >>= 8));
-  PtyWrite(pty, buf, n);
+  ConsoleWrite(buf, n);
 }
 
 static void OnVidyaService(void) {
@@ -2995,18 +3283,21 @@ static void OnVidyaService(void) {
       OnVidyaServiceSetMode();
       break;
     case 0x02:
+      if (reexecuting) break;  // already on the display
       OnVidyaServiceSetCursorPosition();
       break;
     case 0x03:
       OnVidyaServiceGetCursorPosition();
       break;
     case 0x09:
+      if (reexecuting) break;
       OnVidyaServiceWriteCharacter();
-      Redraw(true);
+      ConsoleRedraw(false);
       break;
     case 0x0E:
+      if (reexecuting) break;
       OnVidyaServiceTeletypeOutput();
-      Redraw(true);
+      ConsoleRedraw(false);
       break;
     case 0x0F:
       OnVidyaServiceGetMode();
@@ -3027,6 +3318,17 @@ static void OnKeyboardServiceReadKeyPress(void) {
     //action |= CONTINUE;
   //}
   pty->conf |= kPtyBlinkcursor;
+  if (replaying) {
+    rc = replayResult(0);
+    if (rc == -2) return;
+    if (rc == -1) {
+      exitcode = 0;
+      action |= EXIT;
+      return;
+    }
+    b = rc;
+    goto replayed;
+  }
   if (!pending) {
 again:
     rc = ReadAnsi(ttyin, buf, sizeof(buf));
@@ -3035,8 +3337,10 @@ again:
       pending = rc;
     } else if (rc == -1 && errno == EINTR) {
       if (action & ALARM) goto again;
+      replayResult(-2);
       return;
     } else {
+      replayResult(-1);
       exitcode = 0;
       action |= EXIT;
       return;
@@ -3048,6 +3352,8 @@ again:
     memmove(buf, buf + 1, pending - 1);
   }
   --pending;
+  replayResult(b);
+replayed:
   pty->conf &= ~kPtyBlinkcursor;
   ReactiveDraw();
   if (b == 0177) b = '\b';
@@ -3056,7 +3362,7 @@ again:
 }
 
 static void OnKeyboardServiceCheckKeyPress(void) {
-  bool b = HasPendingKeyboard();
+  bool b = HOSTCALL(HasPendingKeyboard());
   m->flags = SetFlag(m->flags, FLAGS_ZF, !b);   /* ZF=0 if key pressed */
 }
 
@@ -3114,12 +3420,32 @@ static void OnE820(void) {
 }
 #endif
 
+// A20 gate, which only a 286 has
+static void OnA20Service(void) {
+  if (getCPU() != CPU_286 || m->al > 3) {
+    m->ah = 0x86;     // unsupported
+    SetCarry(true);
+    return;
+  }
+  if (m->al == 0x02) {
+    m->al = getA20();
+  } else if (m->al == 0x03) {
+    Put16(m->bx, 3);  // keyboard controller and port 92h
+  } else {
+    setA20(m->al);
+  }
+  m->ah = 0;
+  SetCarry(false);
+}
+
 static void OnInt15h(void) {
   //if (Get32(m->ax) == 0xE820) {
     //OnE820();
   //} else
   if (m->ah == 0x53) {
     OnApmService();
+  } else if (m->ah == 0x24) {
+    OnA20Service();
   } else {
     SetCarry(true);
   }
@@ -3129,8 +3455,9 @@ static void OnInt12h(void) {
   Put16(m->ax, 640);
 }
 
+static unsigned int biosRTC;
+
 static void OnInt1Ah(void) {
-  static unsigned int biosRTC;
   biosRTC++;   // fake up BIOS RTC in CX:DX
   Put16(m->dx, biosRTC >> 4);
   Put16(m->cx, biosRTC >> 12);
@@ -3141,7 +3468,9 @@ extern bool OnHalt(int interrupt);
 bool OnHalt2(int interrupt) {
   LOGF("%" PRIx64 " %s OnHalt(%#x)", GetPc(m), tuimode ? "TUI" : "EXEC",
        interrupt);
-  ReactiveDraw();
+  if (interrupt != 0x10) {
+    ReactiveDraw();   // video output redraws at frame rate
+  }
   switch (interrupt) {
     case 1:
     case 3:
@@ -3348,6 +3677,85 @@ static void OnRestart(void) {
   action |= RESTART;
 }
 
+#if BLINK16
+extern bool RewindMachine(struct Machine *m, Clock when);
+extern void GdbStop(struct Machine *m);
+
+static Clock rerunlast;   // clock the last re-executed instruction started
+static Clock rerunbreak;  // clock a breakpoint was last reached, or never
+
+// re-executes quietly from a rewind until clock, noting breakpoints
+static void Rerun(Clock until) {
+  int interrupt;
+  sigjmp_buf onhalt;
+  volatile Clock stop = until;
+  bool oldtui = tuimode;
+  tuimode = false;  // no drawing from BIOS services
+  memcpy(onhalt, m->onhalt, sizeof(onhalt));
+  rerunlast = cpuClock;
+  rerunbreak = -1;
+  breakconds.nocount = true;  // hits were counted the first time
+  if ((interrupt = sigsetjmp(m->onhalt, 1)) && !OnHalt(interrupt)) {
+    stop = cpuClock;  // faulted where it stopped before
+  }
+  while (cpuClock < stop) {
+    rerunlast = cpuClock;
+    LoadInstruction(m, GetPc(m));
+    if (IsAtBreakpoint2(m->cs.sel, m->ip) != -1) {
+      rerunbreak = cpuClock;
+    }
+    ExecuteInstruction(m);
+  }
+  memcpy(m->onhalt, onhalt, sizeof(onhalt));
+  breakconds.nocount = false;
+  tuimode = oldtui;
+}
+
+static void Rewound(void) {
+  action &= ~(FAILURE | STEP | NEXT | FINISH | CONTINUE);
+  dialog = NULL;
+  setTextBase(vidya == 7 ? 0xB0000 : 0xB8000);
+  console.redraw = true;
+  ScrollOp(&pan.disassembly, GetDisIndex());
+  ScrollMemoryViews();
+}
+
+static void OnStepBack(void) {
+  Clock now = cpuClock;
+  if (!RewindMachine(m, now)) {
+    SetStatus("no earlier checkpoint");
+    return;
+  }
+  Rerun(now);
+  RewindMachine(m, rerunlast + 1);
+  Rerun(rerunlast);
+  Rewound();
+}
+
+// goes back to the last breakpoint reached, or as far as checkpoints go
+static void OnReverseContinue(void) {
+  Clock end = cpuClock, start;
+  while (RewindMachine(m, end)) {
+    start = cpuClock;
+    Rerun(end);
+    if (rerunbreak != (Clock)-1) {
+      end = rerunbreak;
+      RewindMachine(m, end + 1);
+      Rerun(end);
+      Rewound();
+      return;
+    }
+    end = start;
+  }
+  if (end != cpuClock && RewindMachine(m, end + 1)) {
+    SetStatus("no earlier breakpoint");
+    Rewound();
+  } else {
+    SetStatus("no earlier checkpoint");
+  }
+}
+#endif
+
 #if !BLINK16
 static void OnXmmType(void) {
   u8 t;
@@ -3501,6 +3909,10 @@ static void HandleKeyboard(const char *k) {
     CASE('D', displayexec = true;  redrawcycle = false; OnContinueExec());
     CASE('E', displayexec = false; redrawcycle = true;  OnContinueExec());
     CASE('R', OnRestart());
+#if BLINK16
+    CASE('b', OnStepBack());
+    CASE('r', OnReverseContinue());
+#endif
     //CASE('x', OnXmmDisp());
     //CASE('t', OnXmmType());
     //CASE('T', OnXmmSize());
@@ -3587,16 +3999,39 @@ static i64 ParseHexValue(const char *s) {
   return x;
 }
 
+// ADDR [after N] [if EXPR], ADDR being SEG:OFF or a symbol
 static void HandleBreakpointFlag(const char *s) {
   struct Breakpoint b;
+  struct condition *cond = NULL;
+  u32 ignore = 0;
+  const char *err;
+  char *addr, *p;
   memset(&b, 0, sizeof(b));
-  if (isdigit(*s)) {
-    b.seg = ParseHexValue(s);
-    b.addr = ParseHexValue(s+5);    //FIXME requires 0000: before offset
+  unassert((addr = strdup(s)));
+  if ((p = strchr(addr, ' '))) {
+    *p++ = 0;
+    while (*p == ' ') ++p;
+    if (!strncmp(p, "after ", 6)) {
+      ignore = strtoul(p + 6, &p, 10);
+      while (*p == ' ') ++p;
+    }
+    if (!strncmp(p, "if ", 3)) {
+      if (!(cond = compileCondition(p + 3, &err))) {
+        fprintf(stderr, "ERROR: %s in breakpoint: %s\n", err, s);
+        exit(EXIT_FAILURE);
+      }
+    } else if (*p) {
+      fprintf(stderr, "ERROR: bad breakpoint: %s\n", s);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (isdigit(*addr)) {
+    b.seg = ParseHexValue(addr);
+    b.addr = ParseHexValue(addr+5);    //FIXME requires 0000: before offset
   } else {
-    b.symbol = optarg_;
+    b.symbol = addr;
   }
-  PushBreakpoint(&breakpoints, &b);
+  PushBreakpoint2(&b, ignore, cond);
 }
 
 static void HandleWatchpointFlag(const char *s) {
@@ -3650,6 +4085,17 @@ void ProfileOp(struct Machine *m, u64 pc) {
   }
 }
 
+#if BLINK16
+// charges the estimated clocks of the instruction at pc to its symbol
+void ProfileCycles(struct Machine *m, u64 pc, u64 n) {
+  if (opcycles &&                    //
+      pc >= m->system->codestart &&  //
+      pc < m->system->codestart + m->system->codesize) {
+    opcycles[pc - m->system->codestart] += n;
+  }
+}
+#endif
+
 static void Execute(void) {
   u64 c;
   if (g_history.viewing) {
@@ -3663,6 +4109,14 @@ static void Execute(void) {
   }
   if (redrawcycle && (cycle & 0x3FFF) == 0)
     Redraw(false);
+  if ((cycle & 0xFFF) == 0) {
+    if (textChanged() && m->metal && !vidya) {
+      vidya = 3;  // guest writes the CGA text page directly
+    }
+    if (console.redraw || (textChanged() && (vidya == 2 || vidya == 3))) {
+      ConsoleRedraw(false);
+    }
+  }
 }
 
 static void Exec(void) {
@@ -3674,7 +4128,7 @@ static void Exec(void) {
   if (!(interrupt = sigsetjmp(m->onhalt, 1))) {
     m->canhalt = true;
     if (!(action & CONTINUE) &&
-        (bp = IsAtBreakpoint(&breakpoints, m->cs.sel, m->ip)) != -1) {
+        (bp = IsAtBreakpoint2(m->cs.sel, m->ip)) != -1) {
       LOGF("BREAK1 %0*" PRIx64 "", GetAddrHexWidth(), breakpoints.p[bp].addr);
     ReactToPoint:
       tuimode = true;
@@ -3699,8 +4153,11 @@ static void Exec(void) {
     else {
       action &= ~CONTINUE;
       for (;;) {
+#if BLINK16
+        if (gdbAttached && gdbBreak(GetPc(m))) GdbStop(m);
+#endif
         LoadInstruction(m, GetPc(m));
-        if ((bp = IsAtBreakpoint(&breakpoints, m->cs.sel,  m->ip)) != -1) {
+        if ((bp = IsAtBreakpoint2(m->cs.sel, m->ip)) != -1) {
           LOGF("BREAK2 %0*" PRIx64 "", GetAddrHexWidth(),
                breakpoints.p[bp].addr);
           action &= ~(FINISH | NEXT | CONTINUE);
@@ -3724,11 +4181,18 @@ static void Exec(void) {
 #endif
       KeepGoing:
         //CheckFramePointer();
+#if BLINK16
+        if (gdbAttached && (cycle & 0xFFFF) == 0) gdbPoll();
+#endif
         if (action & ALARM) {
           /* TODO(jart): Fix me */
           /* DrawDisplayOnly(&pan.display); */
           action &= ~ALARM;
         }
+        if (action & STATS) {
+          action &= ~STATS;
+          reportCounters();
+        }
         if (action & EXIT) {
           LOGF("EXEC EXIT");
           break;
@@ -3755,7 +4219,7 @@ static void Exec(void) {
     if (OnHalt(interrupt)) {
       if (!tuimode) {
         if (displayexec)
-          DrawDisplayOnly(&pan.display);
+          ConsoleRedraw(false);
         goto KeepGoing;
       }
     }
@@ -3778,7 +4242,7 @@ static void Tui(void) {
       if (!(action & FAILURE)) {
         LoadInstruction(m, GetPc(m));
         if ((action & (FINISH | NEXT | CONTINUE)) &&
-            (bp = IsAtBreakpoint(&breakpoints, m->cs.sel, m->ip)) != -1) {
+            (bp = IsAtBreakpoint2(m->cs.sel, m->ip)) != -1) {
           action &= ~(FINISH | NEXT | CONTINUE);
           LOGF("BREAK %0*" PRIx64 "", GetAddrHexWidth(),
                breakpoints.p[bp].addr);
@@ -3806,6 +4270,10 @@ static void Tui(void) {
         HandleTerminalResize();
         action &= ~WINCHED;
       }
+      if (action & STATS) {
+        action &= ~STATS;
+        reportCounters();
+      }
       interactive = ++tick >= speed;
       if (interactive && speed < 0) {
         Sleep(-speed);
@@ -3926,12 +4394,88 @@ static void Tui(void) {
   TuiCleanup();
 }
 
+#if BLINK16
+static void HandleCpuFlag(const char *s) {
+  if (!strcmp(s, "86") || !strcmp(s, "88") || !strcmp(s, "8086") ||
+      !strcmp(s, "8088")) {
+    setCPU(CPU_8086);
+    bus8 = strstr(s, "88") != NULL;
+  } else if (!strcmp(s, "186") || !strcmp(s, "188")) {
+    setCPU(CPU_186);
+    bus8 = !strcmp(s, "188");
+  } else if (!strcmp(s, "286")) {
+    setCPU(CPU_286);
+  } else {
+    fprintf(stderr, "unknown cpu model: %s\n", s);
+    exit(1);
+  }
+}
+#endif
+
+static const char kGetOpts[] = "S:T:D:hjm:cCvtrzRNsb:Hw:L:1:2:";
+
+#if BLINK16
+static bool TakesValue(const char *arg) {
+  const char *p;
+  for (++arg; *arg; ++arg) {
+    if ((p = strchr(kGetOpts, *arg)) && p[1] == ':') return !arg[1];
+  }
+  return false;
+}
+
+static void HandleLogFlag(int (*start)(const char *), const char *path) {
+  if (start(path) == -1) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+}
+
+static long rewindmb = 64;  // checkpoint memory for reverse execution
+
+// takes --record, --replay, --trace, --stats, --rewind, --xms, --ems, --gdb
+// and --trace-syscalls out of argv, as GetOpt can't
+static int GetLongOpts(int argc, char *argv[]) {
+  int i, j;
+  bool value = false;
+  for (i = j = 1; i < argc; ++i) {
+    if (!value && (argv[i][0] != '-' || !strcmp(argv[i], "--"))) break;
+    if (!value && i + 1 < argc && !strcmp(argv[i], "--record")) {
+      HandleLogFlag(startRecording, argv[++i]);
+    } else if (!value && i + 1 < argc && !strcmp(argv[i], "--replay")) {
+      HandleLogFlag(startReplay, argv[++i]);
+    } else if (!value && i + 1 < argc && !strcmp(argv[i], "--trace")) {
+      HandleLogFlag(startTrace, argv[++i]);
+    } else if (!value && i + 1 < argc && !strcmp(argv[i], "--stats")) {
+      HandleLogFlag(writeCounters, argv[++i]);
+    } else if (!value && i + 1 < argc && !strcmp(argv[i], "--rewind")) {
+      rewindmb = strtol(argv[++i], NULL, 10);
+    } else if (!value && i + 1 < argc && !strcmp(argv[i], "--xms")) {
+      HandleLogFlag(setXMS, argv[++i]);
+    } else if (!value && i + 1 < argc && !strcmp(argv[i], "--ems")) {
+      HandleLogFlag(setEMS, argv[++i]);
+    } else if (!value && i + 1 < argc && !strcmp(argv[i], "--gdb")) {
+      HandleLogFlag(startGdb, argv[++i]);
+    } else if (!value && i + 1 < argc &&
+               !strcmp(argv[i], "--trace-syscalls")) {
+      HandleLogFlag(startSyscallTrace, argv[++i]);
+    } else {
+      value = !value && TakesValue(argv[i]);
+      argv[j++] = argv[i];
+    }
+  }
+  while (i < argc) argv[j++] = argv[i++];
+  argv[j] = 0;
+  return j;
+}
+#endif
+
 static void GetOpts(int argc, char *argv[]) {
   int opt;
   bool wantjit = false;
   bool wantunsafe = false;
   const char *logpath = 0;
-  while ((opt = GetOpt(argc, argv, "S:T:D:hjmCvtrzRNsb:Hw:L:")) != -1) {
+  bool wanttiming = false;
+  while ((opt = GetOpt(argc, argv, kGetOpts)) != -1) {
     switch (opt) {
       case 'S':
         symtab = optarg_;
@@ -3948,12 +4492,17 @@ static void GetOpts(int argc, char *argv[]) {
       case 't':
         tuimode = false;
         break;
+      case 'c':
+        wanttiming = true;
+        break;
       case 'C':
         //FLAG_noconnect = true;
         break;
       case 'm':
+#if BLINK16
+        HandleCpuFlag(optarg_);
+#else
         wantunsafe = true;
-#if !BLINK16
         if (!CanHaveLinearMemory()) {
           fprintf(stderr,
                   "linearization not possible on this system"
@@ -3975,7 +4524,7 @@ static void GetOpts(int argc, char *argv[]) {
         //g_disisprog_disable = true;
         break;
       case 's':
-        //FLAG_statistics = true;
+        showCounters();
         break;
       case 'b':
         HandleBreakpointFlag(optarg_);
@@ -3992,6 +4541,13 @@ static void GetOpts(int argc, char *argv[]) {
       case 'L':
         logpath = optarg_;
         break;
+      case '1':
+      case '2':
+        if (uartAttach(opt - '1', optarg_) == -1) {
+          fprintf(stderr, "COM%c: %s: %s\n", opt, optarg_, strerror(errno));
+          exit(1);
+        }
+        break;
       case 'z':
         ++codeview.zoom;
         ++readview.zoom;
@@ -4005,6 +4561,16 @@ static void GetOpts(int argc, char *argv[]) {
     }
   }
   LogInit(logpath);
+#if BLINK16
+  if (wanttiming) setTiming(bus8);
+  if (gdbAttached) tuimode = false;  // gdb is the debugger
+  // rewinds its own journal only, and can't restore mapped EMS pages
+  if (tuimode && rewindmb > 0 && !replaying && !extendedMemory) {
+    setCheckpoints(rewindmb << 20);
+    addState(&vidya, sizeof(vidya));
+    addState(&biosRTC, sizeof(biosRTC));
+  }
+#endif
   //if (!wantjit) {
     //DisableJit(&m->system->jit);
   //}
@@ -4035,6 +4601,10 @@ int VirtualMachine(int argc, char *argv[]) {
 #if BLINK16
       ophits = (unsigned long *)calloc(1, m->system->codesize * sizeof(unsigned long));
       unassert(ophits);
+      if (timing) {
+        opcycles = (u64 *)calloc(1, m->system->codesize * sizeof(u64));
+        unassert(opcycles);
+      }
 #else
       ophits = (unsigned long *)AllocateBig(
           m->system->codesize * sizeof(unsigned long), PROT_READ | PROT_WRITE,
@@ -4071,8 +4641,10 @@ int VirtualMachine(int argc, char *argv[]) {
         Tui();
       }
     } while (!(action & (RESTART | EXIT)));
-    if (action & RESTART)
+    if (action & RESTART) {
+      FlushConsole();
       PtyWrite(pty, "\e[H\e[J", 6);
+    }
   } while (action & RESTART);
 #if BLINK16
   if (m->metal) {
@@ -4135,12 +4707,18 @@ int main(int argc, char *argv[]) {
   unassert((s = NewSystem()));
   unassert((m = NewMachine(s, 0)));
   //SetMachineMode(m, XED_MODE_LONG);
-  m->system->redraw = Redraw;
+  m->system->redraw = ConsoleRedraw;
+  atexit(FlushConsole);
+  atexit(uartFlush);
   m->system->onbinbase = OnBinbase;
   m->system->onlongbranch = OnLongBranch;
   speed = 1;
   //SetXmmSize(2);
   //SetXmmDisp(kXmmHex);
+#if BLINK16
+  startCounters();
+  argc = GetLongOpts(argc, argv);
+#endif
   GetOpts(argc, argv);
   sigfillset(&sa.sa_mask);
   sa.sa_flags = 0;
@@ -4153,6 +4731,8 @@ int main(int argc, char *argv[]) {
   unassert(!sigaction(SIGWINCH, &sa, 0));
   sa.sa_sigaction = OnSigAlrm;
   unassert(!sigaction(SIGALRM, &sa, 0));
+  sa.sa_sigaction = OnSigUsr1;
+  unassert(!sigaction(SIGUSR1, &sa, 0));
 #ifndef __SANITIZE_THREAD__
   sa.sa_sigaction = OnSigSegv;
   unassert(!sigaction(SIGSEGV, &sa, 0));
@@ -4164,6 +4744,7 @@ int main(int argc, char *argv[]) {
   rc = VirtualMachine(argc, argv);
 #if BLINK16
   if (ophits) free(ophits);
+  if (opcycles) free(opcycles);
 #else
   FreeBig(ophits, m->system->codesize * sizeof(unsigned long));
 #endif
@@ -0,0 +1,213 @@
+/*
+ * Machine state checkpoints for reverse execution in 8086 emulator
+ *
+ * A checkpoint is taken every CHECKPOINT_CLOCKS at an instruction
+ * boundary. Devices register the static state they keep with addState
+ * when initialized, and each checkpoint copies those blocks whole. RAM
+ * is kept as undo pages instead: pages the core's dirty bitmap for
+ * checkpoints shows written since the newest checkpoint are compared
+ * with a copy of RAM as of then, and those changed are saved with their
+ * older contents before the copy is brought up to date. Anything
+ * storing to ram other than through writeByte and writeWord must call
+ * setDirty for this.
+ * Rewinding undoes pages in the copy back to the wanted checkpoint and
+ * puts it in place, then the caller re-executes forward using the inputs
+ * kept in the replay journal, so going back any distance costs at most
+ * one interval of re-execution. The oldest checkpoints are dropped to
+ * keep within the memory budget.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "8086.h"
+#include "replay.h"
+#include "checkpoint.h"
+
+#define PAGESIZE    4096
+#define PAGES       (MEMSIZE / PAGESIZE)
+#define DIRTYBYTES  (PAGESIZE >> (DIRTYSHIFT + 3))  /* bitmap bytes a page */
+#define MAXSTATE    32
+#define NEVER       UINT64_MAX
+
+struct checkpoint {
+    Clock clock;
+    long journal;               /* journal position of next input */
+    Byte *state;                /* registered state blocks */
+    int npages;
+    uint16_t *pages;            /* pages changed since previous checkpoint */
+    Byte *undo;                 /* their contents at previous checkpoint */
+};
+
+Clock nextCheckpoint = NEVER;
+
+static struct {
+    void *p;
+    size_t size;
+} states[MAXSTATE];
+static int nstates;
+static size_t stateSize;
+
+static struct checkpoint *cp;   /* oldest first */
+static int count;
+static int max;
+static size_t budget;
+static size_t used;
+static Byte *base;              /* RAM as of newest checkpoint */
+static Byte dirty[DIRTYPAGES / 8];  /* pages written since */
+
+/* enable checkpoints within a memory budget in bytes */
+void setCheckpoints(size_t bytes)
+{
+    budget = bytes;
+    if (!(base = malloc(MEMSIZE)))
+        runtimeError("Out of memory for checkpoints\n");
+}
+
+/* register a block of state to checkpoint, ignoring repeats */
+void addState(void *p, size_t size)
+{
+    int i;
+
+    for (i=0; i<nstates; i++) {
+        if (states[i].p == p)
+            return;
+    }
+    if (nstates == MAXSTATE)
+        runtimeError("Too many checkpoint state blocks\n");
+    states[nstates].p = p;
+    states[nstates++].size = size;
+    stateSize += size;
+}
+
+static void freeUndo(struct checkpoint *c)
+{
+    used -= c->npages * (PAGESIZE + sizeof(uint16_t));
+    free(c->pages);
+    free(c->undo);
+    c->pages = 0;
+    c->undo = 0;
+    c->npages = 0;
+}
+
+static void freeCheckpoint(struct checkpoint *c)
+{
+    freeUndo(c);
+    used -= stateSize;
+    free(c->state);
+}
+
+/* the new oldest checkpoint is never undone to, nor rewound before */
+static void dropOldest(void)
+{
+    freeCheckpoint(&cp[0]);
+    memmove(cp, cp + 1, --count * sizeof(*cp));
+    freeUndo(&cp[0]);
+    trimJournal(cp[0].journal);
+}
+
+/* discard all checkpoints and take the first, when a program is loaded */
+void resetCheckpoints(void)
+{
+    if (!base)
+        return;
+    while (count)
+        freeCheckpoint(&cp[--count]);
+    startJournal();
+    takeCheckpoint();
+}
+
+static bool written(int page)
+{
+    int i;
+
+    for (i=0; i<DIRTYBYTES; i++) {
+        if (dirty[page * DIRTYBYTES + i])
+            return true;
+    }
+    return false;
+}
+
+void takeCheckpoint(void)
+{
+    struct checkpoint *c;
+    uint16_t changed[PAGES];
+    Byte *p;
+    int i, n;
+
+    nextCheckpoint = cpuClock + CHECKPOINT_CLOCKS;
+    if (count == max) {
+        max = max ? max * 2 : 64;
+        if (!(cp = realloc(cp, max * sizeof(*cp))))
+            runtimeError("Out of memory for checkpoints\n");
+    }
+    c = &cp[count++];
+    c->clock = cpuClock;
+    c->journal = journalPosition();
+    if (!(p = c->state = malloc(stateSize)))
+        runtimeError("Out of memory for checkpoints\n");
+    for (i=0; i<nstates; i++) {
+        memcpy(p, states[i].p, states[i].size);
+        p += states[i].size;
+    }
+    n = 0;
+    takeDirty(DIRTY_CHECKPOINT, dirty);
+    if (count == 1)
+        memcpy(base, ram, MEMSIZE);
+    else {
+        for (i=0; i<PAGES; i++) {
+            if (written(i) &&
+                memcmp(ram + i * PAGESIZE, base + i * PAGESIZE, PAGESIZE))
+                changed[n++] = i;
+        }
+    }
+    c->npages = n;
+    c->pages = malloc(n * sizeof(uint16_t));
+    c->undo = malloc(n * PAGESIZE);
+    if (n && (!c->pages || !c->undo))
+        runtimeError("Out of memory for checkpoints\n");
+    for (i=0; i<n; i++) {
+        c->pages[i] = changed[i];
+        memcpy(c->undo + i * PAGESIZE, base + changed[i] * PAGESIZE, PAGESIZE);
+        memcpy(base + changed[i] * PAGESIZE, ram + changed[i] * PAGESIZE, PAGESIZE);
+    }
+    used += stateSize + n * (PAGESIZE + sizeof(uint16_t));
+    while (count > 2 && used + journalSize() + MEMSIZE > budget)
+        dropOldest();
+}
+
+/*
+ * Restore the newest checkpoint taken before a clock, discarding
+ * those after it, and rewind the journal to re-execute from there.
+ * Returns false if there is none.
+ */
+bool rewindBefore(Clock when)
+{
+    struct checkpoint *c;
+    Byte *p;
+    int i, k;
+
+    for (k=count-1; k>=0 && cp[k].clock >= when; k--)
+        continue;
+    if (k < 0)
+        return false;
+    while (count > k + 1) {
+        c = &cp[--count];
+        for (i=0; i<c->npages; i++)
+            memcpy(base + c->pages[i] * PAGESIZE, c->undo + i * PAGESIZE, PAGESIZE);
+        freeCheckpoint(c);
+    }
+    c = &cp[k];
+    memcpy(ram, base, MEMSIZE);
+    takeDirty(DIRTY_CHECKPOINT, dirty); /* ram is the copy again */
+    for (p=c->state, i=0; i<nstates; i++) {
+        memcpy(states[i].p, p, states[i].size);
+        p += states[i].size;
+    }
+    nextCheckpoint = c->clock + CHECKPOINT_CLOCKS;
+    rewindJournal(c->journal);
+    return true;
+}
+
+Clock oldestCheckpoint(void)
+{
+    return count ? cp[0].clock : NEVER;
+}
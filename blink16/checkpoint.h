@@ -0,0 +1,20 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+/* machine state checkpoints for reverse execution in 8086 emulator */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "sched.h"
+
+#define CHECKPOINT_CLOCKS   (1000000 * INSN_CLOCKS)    /* about 1M instructions */
+
+extern Clock nextCheckpoint;    /* clock due, never when disabled */
+
+void setCheckpoints(size_t budget);
+void addState(void *p, size_t size);
+void resetCheckpoints(void);
+void takeCheckpoint(void);
+bool rewindBefore(Clock when);
+Clock oldestCheckpoint(void);
+
+#endif
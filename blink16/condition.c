@@ -0,0 +1,343 @@
+/*
+ * Breakpoint conditions for 8086 emulator
+ *
+ * A condition such as "cx==0 && byte[ds:si]==0x41" is compiled once, when
+ * the breakpoint is set, to code for a small stack machine, so testing it
+ * each time the breakpoint address is reached is a short loop over a few
+ * ops rather than a parse. Operands are numbers (decimal, or hex with 0x),
+ * registers (ax ... di, es cs ss ds, ip, flags, al ... bh), the flags cf pf
+ * af zf sf df of as 0 or 1, and memory as byte[addr] or word[addr], with
+ * addr linear or seg:off. Operators, highest precedence first, are unary
+ * - ~ !, then + -, then & | ^, then comparisons, then && and ||. Unlike C,
+ * bitwise operators bind tighter than comparisons, so "flags&0x40==0" means
+ * what it looks like. Values are compared and tested as 16-bit words, as
+ * registers are, so "ax==-1" is true for 0xffff and ax+1 wraps to 0, but
+ * arithmetic is wider so an address such as byte[0x12340+5] is above 64K.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "8086.h"
+#include "condition.h"
+
+#define MAXCODE     64
+#define MAXSTACK    16
+
+enum {
+    opNum,          /* push arg */
+    opReg,          /* push regs.w[arg], or IP (12) or flags (13) */
+    opByteReg,      /* push byte register arg */
+    opFlag,         /* push whether flags bit arg is set */
+    opByte,         /* replace linear address with byte there */
+    opWord,         /* replace linear address with word there */
+    opSeg,          /* seg:off to linear address */
+    opNeg, opCpl, opNot,
+    opAdd, opSub, opAnd, opOr, opXor,
+    opEq, opNe, opLt, opLe, opGt, opGe,
+    opLogAnd, opLogOr
+};
+
+struct op {
+    Byte op;
+    DWord arg;
+};
+
+struct condition {
+    int n;
+    struct op code[];
+};
+
+static const char *wordRegs[14] = {
+    "ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+    "es", "cs", "ss", "ds", "ip", "flags"
+};
+static const char *byteRegs[8] = {
+    "al", "cl", "dl", "bl", "ah", "ch", "dh", "bh"
+};
+static const struct {
+    const char *name;
+    Word mask;
+} flagBits[7] = {
+    { "cf", 0x001 }, { "pf", 0x004 }, { "af", 0x010 }, { "zf", 0x040 },
+    { "sf", 0x080 }, { "df", 0x400 }, { "of", 0x800 }
+};
+
+/* compiler state */
+static const char *p;
+static const char *error;
+static struct op code[MAXCODE];
+static int n, depth;
+
+static void emit(int op, DWord arg, int push)
+{
+    if (error)
+        return;
+    if (n == MAXCODE || (depth += push) > MAXSTACK) {
+        error = "condition too long";
+        return;
+    }
+    code[n].op = op;
+    code[n++].arg = arg;
+}
+
+static void skipSpace(void)
+{
+    while (isspace(*p))
+        p++;
+}
+
+/* consume token s if next */
+static bool accept(const char *s)
+{
+    skipSpace();
+    if (strncmp(p, s, strlen(s)))
+        return false;
+    p += strlen(s);
+    return true;
+}
+
+static void expect(const char *s)
+{
+    if (!accept(s) && !error)
+        error = "syntax error";
+}
+
+static void expression(void);
+
+static bool isName(const char *name, int len)
+{
+    return (int)strlen(name) == len && !strncmp(p, name, len);
+}
+
+static void primary(void)
+{
+    const char *q;
+    char *end;
+    int i, len;
+
+    skipSpace();
+    if (isdigit(*p)) {
+        /* not base 0, a leading zero isn't octal */
+        if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+            if (!isxdigit(p[2]) && !error)
+                error = "syntax error";
+            emit(opNum, strtoul(p + 2, &end, 16), 1);
+        } else
+            emit(opNum, strtoul(p, &end, 10), 1);
+        p = end;
+        return;
+    }
+    if (accept("(")) {
+        expression();
+        expect(")");
+        return;
+    }
+    for (q=p; isalnum(*q); q++)
+        continue;
+    len = q - p;
+    if (isName("byte", len) || isName("word", len)) {
+        i = *p == 'b' ? opByte : opWord;
+        p = q;
+        expect("[");
+        expression();
+        if (accept(":")) {
+            expression();
+            emit(opSeg, 0, -1);
+        }
+        expect("]");
+        emit(i, 0, 0);
+        return;
+    }
+    for (i=0; i<14; i++) {
+        if (isName(wordRegs[i], len)) {
+            p = q;
+            emit(opReg, i, 1);
+            return;
+        }
+    }
+    for (i=0; i<8; i++) {
+        if (isName(byteRegs[i], len)) {
+            p = q;
+            emit(opByteReg, i, 1);
+            return;
+        }
+    }
+    for (i=0; i<7; i++) {
+        if (isName(flagBits[i].name, len)) {
+            p = q;
+            emit(opFlag, flagBits[i].mask, 1);
+            return;
+        }
+    }
+    if (!error)
+        error = "bad operand";
+}
+
+static void unary(void)
+{
+    if (accept("-")) {
+        unary();
+        emit(opNeg, 0, 0);
+    } else if (accept("~")) {
+        unary();
+        emit(opCpl, 0, 0);
+    } else if (accept("!")) {
+        unary();
+        emit(opNot, 0, 0);
+    } else
+        primary();
+}
+
+static void sum(void)
+{
+    int op;
+
+    unary();
+    for (;;) {
+        if (accept("+"))
+            op = opAdd;
+        else if (accept("-"))
+            op = opSub;
+        else
+            return;
+        unary();
+        emit(op, 0, -1);
+    }
+}
+
+static void bitwise(void)
+{
+    int op;
+
+    sum();
+    for (;;) {
+        skipSpace();
+        if (p[0] == '&' && p[1] != '&')
+            op = opAnd;
+        else if (p[0] == '|' && p[1] != '|')
+            op = opOr;
+        else if (p[0] == '^')
+            op = opXor;
+        else
+            return;
+        p++;
+        sum();
+        emit(op, 0, -1);
+    }
+}
+
+static void comparison(void)
+{
+    int op;
+
+    bitwise();
+    if (accept("=="))
+        op = opEq;
+    else if (accept("!="))
+        op = opNe;
+    else if (accept("<="))
+        op = opLe;
+    else if (accept(">="))
+        op = opGe;
+    else if (accept("<"))
+        op = opLt;
+    else if (accept(">"))
+        op = opGt;
+    else
+        return;
+    bitwise();
+    emit(op, 0, -1);
+}
+
+/* && and || at one level, evaluated left to right */
+static void expression(void)
+{
+    int op;
+
+    comparison();
+    for (;;) {
+        if (accept("&&"))
+            op = opLogAnd;
+        else if (accept("||"))
+            op = opLogOr;
+        else
+            return;
+        comparison();
+        emit(op, 0, -1);
+    }
+}
+
+/* compile condition s, or return NULL with a reason in *err */
+struct condition *compileCondition(const char *s, const char **err)
+{
+    struct condition *c;
+
+    p = s;
+    error = NULL;
+    n = depth = 0;
+    expression();
+    skipSpace();
+    if (*p && !error)
+        error = "syntax error";
+    if (error) {
+        *err = error;
+        return NULL;
+    }
+    c = malloc(sizeof(*c) + n * sizeof(code[0]));
+    if (!c) {
+        *err = "out of memory";
+        return NULL;
+    }
+    c->n = n;
+    memcpy(c->code, code, n * sizeof(code[0]));
+    return c;
+}
+
+bool testCondition(const struct condition *c)
+{
+    DWord stack[MAXSTACK + 1], *top = stack;
+    const struct op *op, *end = c->code + c->n;
+
+    for (op=c->code; op<end; op++) {
+        switch (op->op) {
+        case opNum:
+            *++top = op->arg;
+            break;
+        case opReg:
+            *++top = op->arg < 12 ? regs.w[op->arg] :
+                op->arg == 12 ? getIP() : getFlags();
+            break;
+        case opByteReg:
+            *++top = regs.b[BYTEREG(op->arg)];
+            break;
+        case opFlag:
+            *++top = (getFlags() & op->arg) != 0;
+            break;
+        case opByte:
+            *top = ram[wrapA20(*top % MEMSIZE)];
+            break;
+        case opWord:
+            *top = ram[wrapA20(*top % MEMSIZE)] |
+                ram[wrapA20((*top + 1) % MEMSIZE)] << 8;
+            break;
+        case opSeg:     top--; *top = (*top << 4) + (Word)top[1]; break;
+        case opNeg:     *top = -*top; break;
+        case opCpl:     *top = ~*top; break;
+        case opNot:     *top = !(Word)*top; break;
+        case opAdd:     top--; *top += top[1]; break;
+        case opSub:     top--; *top -= top[1]; break;
+        case opAnd:     top--; *top &= top[1]; break;
+        case opOr:      top--; *top |= top[1]; break;
+        case opXor:     top--; *top ^= top[1]; break;
+        case opEq:      top--; *top = (Word)*top == (Word)top[1]; break;
+        case opNe:      top--; *top = (Word)*top != (Word)top[1]; break;
+        case opLt:      top--; *top = (Word)*top < (Word)top[1]; break;
+        case opLe:      top--; *top = (Word)*top <= (Word)top[1]; break;
+        case opGt:      top--; *top = (Word)*top > (Word)top[1]; break;
+        case opGe:      top--; *top = (Word)*top >= (Word)top[1]; break;
+        case opLogAnd:  top--; *top = (Word)*top && (Word)top[1]; break;
+        case opLogOr:   top--; *top = (Word)*top || (Word)top[1]; break;
+        }
+    }
+    return (Word)top[0] != 0;
+}
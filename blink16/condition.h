@@ -0,0 +1,12 @@
+#ifndef CONDITION_H_
+#define CONDITION_H_
+/* breakpoint conditions for 8086 emulator */
+
+#include <stdbool.h>
+
+struct condition;
+
+struct condition *compileCondition(const char *s, const char **error);
+bool testCondition(const struct condition *c);
+
+#endif
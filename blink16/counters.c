@@ -0,0 +1,279 @@
+/*
+ * Performance counters for 8086 emulator
+ *
+ * The emulator bumps fields of one global struct as it goes, each an
+ * increment on a path already doing far more work, so they are always
+ * kept. They are reported at exit, as a table on stderr with -s or as
+ * JSON to a file with --stats, and again whenever SIGUSR1 arrives, the
+ * JSON file being rewritten each time. Throughput in MIPS is taken
+ * over host CPU time, which leaves out time slept keeping guest time.
+ *
+ * Host time is also split between interpreting and the handlers that
+ * enterTimer and leaveTimer bracket: system calls, BIOS services,
+ * display updates and sleeping while the guest idles. Each stretch of
+ * time is charged to the innermost, so a redraw during a system call
+ * counts as display, and the rest is interpreting. Each call is also
+ * counted in a histogram of how long it took, inclusive of nesting.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include "counters.h"
+
+struct counters counters;
+
+static bool text;
+static const char *jsonPath;
+static bool atExit;
+static struct timespec start;
+static int current;             /* TIME_ category being charged */
+static uint64_t since;          /* when it last was */
+
+static const char *timeNames[NTIMES] = {
+    "interpret", "syscall", "bios", "display", "idle"
+};
+
+static uint64_t nanoseconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void startCounters(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    since = nanoseconds();
+}
+
+/* charge time since the last switch to the current category */
+static uint64_t charge(void)
+{
+    uint64_t now = nanoseconds();
+
+    counters.nanos[current] += now - since;
+    return since = now;
+}
+
+/* switch to charging category until leaveTimer */
+struct timer enterTimer(int category)
+{
+    struct timer t = { current, 0 };
+
+    if (category == current)
+        return t;
+    t.start = charge();
+    current = category;
+    return t;
+}
+
+void leaveTimer(struct timer t)
+{
+    uint64_t us;
+    int i;
+
+    if (!t.start)
+        return;
+    us = (charge() - t.start) / 1000;
+    for (i=0; us && i<NLATENCY-1; i++)
+        us >>= 1;
+    counters.latency[current][i]++;
+    current = t.outer;
+}
+
+static void reportAtExit(void)
+{
+    if (!atExit) {
+        atExit = true;
+        atexit(reportCounters);
+    }
+}
+
+/* print a table on stderr at exit */
+void showCounters(void)
+{
+    text = true;
+    reportAtExit();
+}
+
+/* write JSON to path at exit, failing now if it can't be created */
+int writeCounters(const char *path)
+{
+    FILE *fp;
+
+    if (!(fp = fopen(path, "w")))
+        return -1;
+    fclose(fp);
+    jsonPath = path;
+    reportAtExit();
+    return 0;
+}
+
+static double seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static double mips(double cpu)
+{
+    return cpu > 0 ? counters.instructions / cpu / 1e6 : 0;
+}
+
+/* tables are keyed by number, in hex if it's an AH value or vector */
+static void printTable(FILE *fp, const char *name, const uint64_t *table,
+    bool hex)
+{
+    char buf[32];
+    int i;
+
+    for (i=0; i<256; i++) {
+        if (table[i]) {
+            snprintf(buf, sizeof(buf), hex ? "%s_%02x" : "%s_%d", name, i);
+            fprintf(fp, "%-32s = %llu\n", buf, (unsigned long long)table[i]);
+        }
+    }
+}
+
+static double percent(int category)
+{
+    uint64_t total = 0;
+    int i;
+
+    for (i=0; i<NTIMES; i++)
+        total += counters.nanos[i];
+    return total ? 100.0 * counters.nanos[category] / total : 0;
+}
+
+/* latency buckets are named by their upper bound in microseconds */
+static void printTimes(FILE *fp)
+{
+    char buf[48];
+    int i, j;
+
+    for (i=0; i<NTIMES; i++) {
+        snprintf(buf, sizeof(buf), "%s_seconds", timeNames[i]);
+        fprintf(fp, "%-32s = %.3f (%.1f%%)\n", buf, counters.nanos[i] / 1e9,
+            percent(i));
+    }
+    for (i=1; i<NTIMES; i++) {
+        for (j=0; j<NLATENCY; j++) {
+            if (counters.latency[i][j]) {
+                snprintf(buf, sizeof(buf), "%s_under_%luus", timeNames[i],
+                    1UL << j);
+                fprintf(fp, "%-32s = %llu\n", buf,
+                    (unsigned long long)counters.latency[i][j]);
+            }
+        }
+    }
+}
+
+static void jsonTimes(FILE *fp)
+{
+    const char *sep;
+    int i, j;
+
+    for (i=0; i<NTIMES; i++) {
+        fprintf(fp, "  \"%s_seconds\": %.6f,\n", timeNames[i],
+            counters.nanos[i] / 1e9);
+        fprintf(fp, "  \"%s_percent\": %.2f,\n", timeNames[i], percent(i));
+    }
+    for (i=1; i<NTIMES; i++) {
+        fprintf(fp, "  \"%s_latency_us\": {", timeNames[i]);
+        for (j=0, sep=""; j<NLATENCY; j++) {
+            if (counters.latency[i][j]) {
+                fprintf(fp, "%s\"%lu\": %llu", sep, 1UL << j,
+                    (unsigned long long)counters.latency[i][j]);
+                sep = ", ";
+            }
+        }
+        fprintf(fp, "},\n");
+    }
+}
+
+static void printText(FILE *fp, double wall, double cpu)
+{
+#define COUNT(name, value) \
+    fprintf(fp, "%-32s = %llu\n", name, (unsigned long long)(value))
+    COUNT("instructions", counters.instructions);
+    COUNT("rep_iterations", counters.repIterations);
+    fprintf(fp, "%-32s = %.3f\n", "seconds", wall);
+    fprintf(fp, "%-32s = %.3f\n", "cpu_seconds", cpu);
+    fprintf(fp, "%-32s = %.3f\n", "mips", mips(cpu));
+    COUNT("shadow_checks", counters.shadowChecks);
+    COUNT("shadow_failures_avoided", counters.shadowAvoided);
+    printTable(fp, "elks_syscall", counters.elksSyscalls, false);
+    printTable(fp, "dos_call", counters.dosCalls, true);
+    printTable(fp, "bios_int", counters.biosInterrupts, true);
+    COUNT("sectors_read", counters.sectorsRead);
+    COUNT("sectors_written", counters.sectorsWritten);
+    COUNT("redraws", counters.redraws);
+    COUNT("redraw_bytes", counters.redrawBytes);
+    COUNT("output_bytes", counters.outputBytes);
+    printTimes(fp);
+#undef COUNT
+}
+
+static void jsonTable(FILE *fp, const char *name, const uint64_t *table,
+    bool hex)
+{
+    const char *sep = "";
+    int i;
+
+    fprintf(fp, "  \"%s\": {", name);
+    for (i=0; i<256; i++) {
+        if (table[i]) {
+            fprintf(fp, hex ? "%s\"%02x\": %llu" : "%s\"%d\": %llu", sep, i,
+                (unsigned long long)table[i]);
+            sep = ", ";
+        }
+    }
+    fprintf(fp, "},\n");
+}
+
+static void printJSON(FILE *fp, double wall, double cpu)
+{
+#define COUNT(name, value) \
+    fprintf(fp, "  \"%s\": %llu,\n", name, (unsigned long long)(value))
+    fprintf(fp, "{\n");
+    COUNT("instructions", counters.instructions);
+    COUNT("rep_iterations", counters.repIterations);
+    fprintf(fp, "  \"seconds\": %.6f,\n", wall);
+    fprintf(fp, "  \"cpu_seconds\": %.6f,\n", cpu);
+    fprintf(fp, "  \"mips\": %.3f,\n", mips(cpu));
+    COUNT("shadow_checks", counters.shadowChecks);
+    COUNT("shadow_failures_avoided", counters.shadowAvoided);
+    jsonTable(fp, "elks_syscalls", counters.elksSyscalls, false);
+    jsonTable(fp, "dos_calls", counters.dosCalls, true);
+    jsonTable(fp, "bios_interrupts", counters.biosInterrupts, true);
+    COUNT("sectors_read", counters.sectorsRead);
+    COUNT("sectors_written", counters.sectorsWritten);
+    COUNT("redraws", counters.redraws);
+    COUNT("redraw_bytes", counters.redrawBytes);
+    jsonTimes(fp);
+    fprintf(fp, "  \"output_bytes\": %llu\n}\n",
+        (unsigned long long)counters.outputBytes);
+#undef COUNT
+}
+
+/* report as asked for, on stderr if neither was */
+void reportCounters(void)
+{
+    double wall = seconds();
+    double cpu = (double)clock() / CLOCKS_PER_SEC;
+    FILE *fp;
+
+    charge();
+    if (text || !jsonPath) {
+        printText(stderr, wall, cpu);
+        fflush(stderr);
+    }
+    if (jsonPath && (fp = fopen(jsonPath, "w"))) {
+        printJSON(fp, wall, cpu);
+        fclose(fp);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef COUNTERS_H_
+#define COUNTERS_H_
+/* performance counters for 8086 emulator */
+
+#include <stdint.h>
+
+/* where host time goes, each nanosecond charged to one */
+enum { TIME_INTERPRET, TIME_SYSCALL, TIME_BIOS, TIME_DISPLAY, TIME_IDLE,
+    NTIMES };
+#define NLATENCY    24          /* under 1us, then doubling up to 8s */
+
+struct counters {
+    uint64_t instructions;      /* executed, a REP instruction counts once */
+    uint64_t repIterations;     /* string operations done under REP */
+    uint64_t shadowChecks;      /* memory accesses checked against shadow RAM */
+    uint64_t shadowAvoided;     /* loader writes the check let through */
+    uint64_t elksSyscalls[256]; /* by AX */
+    uint64_t dosCalls[256];     /* INT 21h by AH */
+    uint64_t biosInterrupts[256];   /* by vector */
+    uint64_t sectorsRead;
+    uint64_t sectorsWritten;
+    uint64_t redraws;           /* TUI frames written to the terminal */
+    uint64_t redrawBytes;
+    uint64_t outputBytes;       /* guest console and serial output */
+    uint64_t nanos[NTIMES];     /* host time, nested calls excluded */
+    uint64_t latency[NTIMES][NLATENCY]; /* calls by time, nested included */
+};
+
+struct timer {
+    int outer;                  /* category to return to */
+    uint64_t start;             /* 0 when already in this category */
+};
+
+extern struct counters counters;
+
+void startCounters(void);
+void showCounters(void);
+int writeCounters(const char *path);
+void reportCounters(void);
+struct timer enterTimer(int category);
+void leaveTimer(struct timer t);
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ * Tests for the exomizer decruncher in decompress.c
+ *
+ * Usage: decompress-test
+ *
+ * Streams are built here in the order exoDecrunch reads them, bits into
+ * bytes that are taken when the bit buffer empties and literals as whole
+ * bytes, then reversed to the backwards layout ELKS uses. A small valid
+ * stream must decrunch exactly. Every truncation of it, and streams with
+ * a zero length literal sequence or a match reaching past the output,
+ * must fail without writing outside the output buffer, which is checked
+ * with guard bytes either side. Exits 1 on a failure.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "decompress.h"
+
+#define MAXSTREAM   256
+#define GUARD       64
+#define GUARDBYTE   0xa5
+
+/* a stream under construction, in read order */
+struct stream {
+    uint8_t b[MAXSTREAM];
+    int n;
+    int bitByte;            /* byte taking bits, -1 if none */
+    int bitCount;
+};
+
+static int failures;
+
+static void start(struct stream *s)
+{
+    s->n = 0;
+    s->b[s->n++] = 0x80;    /* initial bit buffer, empty but for sentinel */
+    s->bitByte = -1;
+}
+
+static void putBit(struct stream *s, int bit)
+{
+    if (s->bitByte < 0 || s->bitCount == 8) {
+        s->bitByte = s->n;
+        s->b[s->n++] = 0;
+        s->bitCount = 0;
+    }
+    s->b[s->bitByte] |= bit << (7 - s->bitCount++);
+}
+
+static void putBits(struct stream *s, unsigned value, int count)
+{
+    while (count & 7)
+        putBit(s, (value >> --count) & 1);
+    while (count >= 8) {
+        count -= 8;
+        s->b[s->n++] = value >> count;
+    }
+}
+
+static void putByte(struct stream *s, int c)
+{
+    s->b[s->n++] = c;
+}
+
+/* sequence of index zero bits ended by a one */
+static void putIndex(struct stream *s, int index)
+{
+    while (index--)
+        putBit(s, 0);
+    putBit(s, 1);
+}
+
+/* all table entries zero bits, so lengths and offsets are index + 1 */
+static void putTable(struct stream *s)
+{
+    int i;
+
+    for (i=0; i<52; i++)
+        putBits(s, 0, 4);
+}
+
+static void putEnd(struct stream *s)
+{
+    putBit(s, 0);
+    putIndex(s, 16);
+}
+
+/* decrunch the reversed stream s[0..n) into len bytes, checking guards */
+static int decrunch(const struct stream *s, int n, uint8_t *out, int len)
+{
+    uint8_t in[MAXSTREAM], buf[GUARD + 64 + GUARD];
+    int i, result;
+
+    for (i=0; i<n; i++)
+        in[i] = s->b[n - 1 - i];
+    memset(buf, GUARDBYTE, sizeof(buf));
+    result = exoDecrunch(in, n, buf + GUARD, len);
+    for (i=0; i<GUARD; i++) {
+        if (buf[i] != GUARDBYTE || buf[GUARD + len + i] != GUARDBYTE) {
+            printf("wrote outside output, stream length %d\n", n);
+            failures++;
+            break;
+        }
+    }
+    if (out)
+        memcpy(out, buf + GUARD, len);
+    return result;
+}
+
+static void expect(const char *name, bool ok)
+{
+    if (!ok) {
+        printf("FAIL %s\n", name);
+        failures++;
+    }
+}
+
+/* "BABA": implicit literal A, literal B, match length 2 offset 2 */
+static void validStream(struct stream *s)
+{
+    start(s);
+    putTable(s);
+    putByte(s, 'A');
+    putBit(s, 1);
+    putByte(s, 'B');
+    putBit(s, 0);
+    putIndex(s, 1);         /* length 2 */
+    putBits(s, 1, 4);       /* offset index 32 + 1, offset 2 */
+    putEnd(s);
+}
+
+int main(void)
+{
+    struct stream s;
+    uint8_t out[64];
+    int i, bad;
+
+    validStream(&s);
+    expect("valid stream", decrunch(&s, s.n, out, 4) == 0 &&
+        !memcmp(out, "BABA", 4));
+    expect("short output", decrunch(&s, s.n, 0, 3) < 0);
+    expect("long output", decrunch(&s, s.n, 0, 5) < 0);
+
+    for (i=bad=0; i<s.n; i++)
+        bad += decrunch(&s, i, 0, 4) == 0;
+    expect("truncated streams", bad == 0);
+
+    start(&s);
+    putTable(&s);
+    putByte(&s, 'A');
+    putBit(&s, 0);
+    putIndex(&s, 17);       /* literal sequence */
+    putBits(&s, 0, 16);     /* of no bytes */
+    putEnd(&s);
+    expect("zero length literal sequence", decrunch(&s, s.n, 0, 8) < 0);
+
+    start(&s);
+    putTable(&s);
+    putByte(&s, 'A');
+    putBit(&s, 0);
+    putIndex(&s, 0);        /* length 1 */
+    putBits(&s, 3, 2);      /* offset index 48 + 3, offset 4 */
+    putEnd(&s);
+    expect("match past output", decrunch(&s, s.n, 0, 2) < 0);
+
+    if (failures)
+        return 1;
+    printf("decompress: all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Exomizer raw backwards decruncher for 8086 emulator
+ *
+ * ELKS compresses executable sections with "exomizer raw -b", the
+ * default exomizer 3 protocol crunched backwards. Both streams are
+ * walked from their last byte towards the first. The bit stream is
+ * read MSB first through a one byte buffer holding a sentinel bit,
+ * reads of eight or more bits take whole bytes from the byte stream,
+ * the first output byte is an implicit literal, and a match directly
+ * after literals may reuse the previous match offset.
+ * Unlike the ELKS kernel this never decrunches in place, so no safety
+ * margin is needed, but every access is bounds checked instead.
+ */
+#include <stdbool.h>
+#include "decompress.h"
+
+#define TABLESIZE   52      /* 16 lengths, 16+16+4 offsets by length */
+
+struct crunched {
+    const uint8_t *start;
+    const uint8_t *in;      /* one past next byte to read */
+    uint8_t bitBuffer;
+    bool error;
+    uint16_t base[TABLESIZE];
+    uint8_t bits[TABLESIZE];
+};
+
+static int getByte(struct crunched *c)
+{
+    if (c->in == c->start) {
+        c->error = true;
+        return 0;
+    }
+    return *--c->in;
+}
+
+static unsigned getBits(struct crunched *c, int count)
+{
+    unsigned value = 0;
+    int carry;
+
+    for (; count & 7; count--) {
+        carry = c->bitBuffer >> 7;
+        c->bitBuffer <<= 1;
+        if (c->bitBuffer == 0) {
+            c->bitBuffer = getByte(c);
+            carry = c->bitBuffer >> 7;
+            c->bitBuffer = (c->bitBuffer << 1) | 1;
+        }
+        value = (value << 1) | carry;
+    }
+    for (; count >= 8; count -= 8)
+        value = (value << 8) | getByte(c);
+    return value;
+}
+
+static void initTable(struct crunched *c)
+{
+    unsigned b2 = 1;
+    int i;
+
+    for (i=0; i<TABLESIZE; i++) {
+        if ((i & 15) == 0)
+            b2 = 1;
+        c->base[i] = b2;
+        c->bits[i] = getBits(c, 4);
+        b2 += 1 << c->bits[i];
+    }
+}
+
+/* returns 0 if exactly outlen bytes were produced, else -1 */
+int exoDecrunch(const uint8_t *in, size_t inlen, uint8_t *out, size_t outlen)
+{
+    struct crunched c;
+    uint8_t *p = out + outlen;
+    unsigned index, length, offset = 0;
+    unsigned reuse = 1;     /* literal history, 1 bit per sequence */
+    bool literal;
+
+    c.start = in;
+    c.in = in + inlen;
+    c.error = false;
+    c.bitBuffer = getByte(&c);
+    initTable(&c);
+    literal = true;
+    length = 1;             /* implicit first literal */
+    for (;;) {
+        if (!length || length > p - out || c.error ||
+            (!literal && offset > out + outlen - p))
+            return -1;
+        do {
+            --p;
+            *p = literal ? getByte(&c) : p[offset];
+        } while (--length > 0 && !c.error);
+        reuse = (reuse << 1) | literal;
+
+        literal = getBits(&c, 1);
+        if (literal) {
+            length = 1;
+            continue;
+        }
+        for (index=0; getBits(&c, 1) == 0; index++) {
+            if (index > 17 || c.error)
+                return -1;
+        }
+        if (index == 16)                /* end of stream */
+            break;
+        if (index == 17) {              /* literal sequence */
+            literal = true;
+            length = getBits(&c, 16);
+            continue;
+        }
+        if (index > 15)
+            return -1;
+        length = c.base[index] + getBits(&c, c.bits[index]);
+        if ((reuse & 3) != 1 || !getBits(&c, 1)) {
+            switch (length) {
+            case 1:  index = 48 + getBits(&c, 2); break;
+            case 2:  index = 32 + getBits(&c, 4); break;
+            default: index = 16 + getBits(&c, 4); break;
+            }
+            offset = c.base[index] + getBits(&c, c.bits[index]);
+        }
+    }
+    return (c.error || p != out) ? -1 : 0;
+}
@@ -0,0 +1,10 @@
+#ifndef DECOMPRESS_H_
+#define DECOMPRESS_H_
+/* decompression of compressed ELKS executable sections */
+
+#include <stddef.h>
+#include <stdint.h>
+
+int exoDecrunch(const uint8_t *in, size_t inlen, uint8_t *out, size_t outlen);
+
+#endif
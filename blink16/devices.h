@@ -0,0 +1,37 @@
+#ifndef DEVICES_H_
+#define DEVICES_H_
+/* PC hardware devices for 8086 emulator */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* 8259 interrupt controllers */
+extern bool irqPending;             /* unmasked IRQ awaiting the CPU */
+void initPIC(void);
+bool picUnmasked(void);
+void picRaiseIRQ(int irq);
+void picLowerIRQ(int irq);
+int picAcknowledge(void);
+uint8_t picRead(uint16_t port);
+void picWrite(uint16_t port, uint8_t value);
+
+/* 8253 interval timer */
+#define PIT_HZ          1193182     /* timer input clock */
+#define PIT_DIVISOR     4           /* processor clocks per timer tick */
+void initPIT(void);
+uint8_t pitRead(uint16_t port);
+void pitWrite(uint16_t port, uint8_t value);
+
+/* 16550 serial ports */
+int uartAttach(int n, const char *spec);
+void initUART(void);
+void uartFlush(void);
+
+/* A20 gate at port 92h and the 8042 keyboard controller */
+void initA20(void);
+uint8_t kbcRead(uint16_t port);
+void kbcWrite(uint16_t port, uint8_t value);
+uint8_t a20Read(uint16_t port);
+void a20Write(uint16_t port, uint8_t value);
+
+#endif
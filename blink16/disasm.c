@@ -128,6 +128,8 @@ static void outRM(struct dis *d, Word w)
 #define JMP         0x2000  /* display jmp w/byte, word or dword operand */
 #define SHIFTBY1    0x4000  /* display shift 1 operand */
 #define SHIFTBYCL   0x8000  /* display shift CL operand */
+#define IMMBYTE2    0x10000 /* fetch and display second byte immediate (ENTER) */
+#define REGLAST     0x20000 /* display REG operand last (IMUL imm) */
 
 static void out_bw(struct dis *d, int flags)
 {
@@ -171,6 +173,7 @@ static void outs(struct dis *d, const char *str, int flags)
 {
     Word w = 0;
     Word w2 = 0;
+    Byte b2 = 0;
     signed char c = 0;
 
     if (flags & RDMOD)
@@ -192,6 +195,8 @@ static void outs(struct dis *d, const char *str, int flags)
         w2 = c = d_fetchByte(d);
     if (flags & DWORD)
         w = d_fetchWord(d);
+    if (flags & IMMBYTE2)
+        b2 = d_fetchByte(d);
 
     if (!(d->flags & fDisInst))
         return;
@@ -235,12 +240,14 @@ static void outs(struct dis *d, const char *str, int flags)
     }
     else if (flags & IMM) {
         d->s += sprintf(d->s, "$0x%x", w2);
-        if (flags != (flags & IMM))
+        if (flags & ~(IMM|SBYTE))
             d->s += sprintf(d->s, ",");
     }
+    if (flags & IMMBYTE2) d->s += sprintf(d->s, "$0x%x", b2);
     if (flags & SHIFTBY1) d->s += sprintf(d->s, "$1,");
     if (flags & SHIFTBYCL) d->s += sprintf(d->s, "%%cl,");
     if (flags & RM) outRM(d, w);
+    if (flags & REGLAST) d->s += sprintf(d->s, ",%s", wordregs[d_modRMReg()]);
     if ((flags & (OPS2|SREG)) == SREG)  outSREG(d);
     if ((flags & ACC) && sourceIsRM == 0)
         d->s += sprintf(d->s, "%s,", wordSize? wordregs[0]: byteregs[0]);
@@ -346,10 +353,45 @@ static void decode(struct dis *d)
                 wordSize = 1;
                 outs(d, "pop", REGOP);
                 break;
-            case 0x60: case 0x61: case 0x62: case 0x63:
-            case 0x68: case 0x69: case 0x6a: case 0x6b:
-            case 0x6c: case 0x6d: case 0x6e: case 0x6f:
-            case 0xc0: case 0xc1: case 0xc8: case 0xc9:  // invalid
+            case 0x60:  // PUSHA
+                outs(d, "pusha", 0);
+                break;
+            case 0x61:  // POPA
+                outs(d, "popa", 0);
+                break;
+            case 0x62:  // BOUND
+                wordSize = 1;
+                sourceIsRM = 0;
+                outs(d, "bound", RDMOD|OPS2);
+                break;
+            case 0x68:  // PUSH iw
+                wordSize = 1;
+                outs(d, "push", IMM);
+                break;
+            case 0x6a:  // PUSH ib
+                outs(d, "push", IMM|SBYTE);
+                break;
+            case 0x69:  // IMUL rw,rmw,iw
+                wordSize = 1;
+                outs(d, "imul", RDMOD|IMM|WORD|RM|REGLAST);
+                break;
+            case 0x6b:  // IMUL rw,rmw,ib
+                wordSize = 1;
+                outs(d, "imul", RDMOD|IMM|SBYTE|RM|REGLAST);
+                break;
+            case 0x6c: case 0x6d:  // INSv
+                outs(d, "ins", BW);
+                break;
+            case 0x6e: case 0x6f:  // OUTSv
+                outs(d, "outs", BW);
+                break;
+            case 0xc8:  // ENTER
+                outs(d, "enter", IMM|WORD|IMMBYTE2);
+                break;
+            case 0xc9:  // LEAVE
+                outs(d, "leave", 0);
+                break;
+            case 0x63:  // ARPL
             case 0xf1:
             case 0xd8: case 0xd9: case 0xda: case 0xdb:
             case 0xdc: case 0xdd: case 0xde: case 0xdf:  // escape
@@ -529,13 +571,15 @@ static void decode(struct dis *d)
             case 0xcf:  // IRET
                 outs(d, "iret", 0);
                 break;
+            case 0xc0: case 0xc1:  // rot rmv,ib
             case 0xd0: case 0xd1: case 0xd2: case 0xd3:  // rot rmv,n
                 {
                 static const char *rotates[] = {
                     "rol", "ror", "rcl", "rcr", "shl", "shr", "shl", "sar" };
                 d_modRM = d_fetchByte(d);
                 flags = BW|RM;
-                if (opcode & 2) flags |= SHIFTBYCL;
+                if (opcode < 0xd0) flags |= IMM|BYTE;
+                else if (opcode & 2) flags |= SHIFTBYCL;
                 else flags |= SHIFTBY1;
                 outs(d, rotates[d_modRMReg()], flags);
                 }
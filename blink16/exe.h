@@ -40,6 +40,11 @@ struct minix_reloc {
     uint16_t  r_type;           /* relocation type */           // 0x06
 };
 
+#define R_SEGWORD   80          /* r_type: segment word relocation */
+#define S_TEXT      (-2)        /* r_symndx: text segment */
+#define S_DATA      (-3)        /* r_symndx: data segment */
+#define S_FTEXT     (-5)        /* r_symndx: far text segment */
+
 struct image_dos_header {       // DOS .EXE header
     uint16_t e_magic;           // Magic number                  // 0x00
     uint16_t e_cblp;            // Bytes on last page of file    // 0x02
@@ -0,0 +1,124 @@
+/*
+ * Mapped executable file cache for 8086 emulator loaders
+ *
+ * Loaders map executables read-only instead of reading them, so each
+ * section goes to ram in one copy straight from the page cache, which
+ * also shares it between emulators running the same program. Mappings
+ * are kept by path while the file's size and modification time stay
+ * the same, so loading it again, on a restart or for its symbols or
+ * decompression cache key, opens nothing and hashes nothing twice.
+ * Sections can't be mapped into ram itself, as a.out and MZ sections
+ * don't start on page boundaries in the file. A mapping is in use from
+ * mapExecutable until releaseExecutable, and isn't unmapped to make
+ * room or because its file changed until then. Parsed headers and
+ * symbols aren't cached: a header is a copy of a few dozen bytes and a
+ * check, and the symbol table must be copied for each load anyway, as
+ * sym_free frees it. The cache lasts as long as the process, other
+ * processes share the file through the host page cache.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "exefile.h"
+
+#define MAXFILES    8
+
+static struct exeFile files[MAXFILES];
+static int next;                /* slot to reuse when full */
+
+static void unmap(struct exeFile *f)
+{
+    if (f->size)
+        munmap((void *)f->map, f->size);
+    free(f->path);
+    memset(f, 0, sizeof(*f));
+}
+
+/* map path, or return its mapping if unchanged, NULL on error */
+struct exeFile *mapExecutable(const char *path)
+{
+    static const unsigned char empty[1];
+    struct exeFile *f = 0;
+    struct stat sbuf;
+    void *map;
+    int i, fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return 0;
+    if (fstat(fd, &sbuf) < 0) {
+        close(fd);
+        return 0;
+    }
+    for (i=0; i<MAXFILES; i++) {
+        if (files[i].path && !strcmp(files[i].path, path)) {
+            if (files[i].size == (size_t)sbuf.st_size &&
+                files[i].mtime.tv_sec == sbuf.st_mtim.tv_sec &&
+                files[i].mtime.tv_nsec == sbuf.st_mtim.tv_nsec) {
+                close(fd);
+                files[i].users++;
+                return &files[i];
+            }
+            if (!files[i].users) {
+                unmap(&files[i]);
+                f = &files[i];
+                break;
+            }
+        }
+    }
+    if (!f) {
+        for (i=0; i<MAXFILES && files[i].path; i++)
+            continue;
+        if (i == MAXFILES) {
+            for (i=0; i<MAXFILES && files[next].users; i++)
+                next = (next + 1) % MAXFILES;
+            if (i == MAXFILES) {
+                close(fd);
+                return 0;
+            }
+            i = next;
+            next = (next + 1) % MAXFILES;
+            unmap(&files[i]);
+        }
+        f = &files[i];
+    }
+    map = (void *)empty;
+    if (sbuf.st_size &&
+        (map = mmap(0, sbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+    close(fd);
+    if (!(f->path = strdup(path))) {
+        if (sbuf.st_size)
+            munmap(map, sbuf.st_size);
+        return 0;
+    }
+    f->mtime = sbuf.st_mtim;
+    f->size = sbuf.st_size;
+    f->map = map;
+    f->hash = 0;
+    f->users = 1;
+    return f;
+}
+
+/* done with a mapping from mapExecutable, which may then be reused */
+void releaseExecutable(struct exeFile *f)
+{
+    f->users--;
+}
+
+uint64_t hashExecutable(struct exeFile *f)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    if (!f->hash) {
+        for (i=0; i<f->size; i++)
+            hash = (hash ^ f->map[i]) * 0x100000001b3ULL;
+        f->hash = hash;
+    }
+    return f->hash;
+}
@@ -0,0 +1,22 @@
+#ifndef EXEFILE_H_
+#define EXEFILE_H_
+/* mapped executable file cache for 8086 emulator loaders */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+struct exeFile {
+    char *path;
+    struct timespec mtime;      /* with size, says the file is unchanged */
+    size_t size;
+    const unsigned char *map;
+    uint64_t hash;              /* FNV-1a of contents, 0 until asked for */
+    int users;                  /* mapped and not yet released */
+};
+
+struct exeFile *mapExecutable(const char *path);
+void releaseExecutable(struct exeFile *f);
+uint64_t hashExecutable(struct exeFile *f);
+
+#endif
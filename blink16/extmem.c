@@ -0,0 +1,651 @@
+/*
+ * XMS and EMS memory for DOS programs
+ *
+ * Memory beyond 640K comes from one store, a memfd the host commits a
+ * page at a time as it is first touched, so asking for lots costs
+ * nothing until a program uses it. EMS pages are its first part and
+ * XMS blocks follow. An INT 2Fh installation check hands out an XMS
+ * entry point whose stub traps to INT_XMS. On a 286 the driver also
+ * hands out the HMA and works the A20 gate. XMS moves copy, as XMS says
+ * they do. The EMS page frame at D000 is instead four windows of ram
+ * remapped onto store pages with mmap, so mapping a page swaps the host
+ * pages behind it rather than copying 16K in and out, and the CPU and
+ * everything else reading ram sees the mapped page directly. This needs
+ * ram aligned to the page size and is why checkpoints can't be used
+ * with extended memory, as restoring ram would write through the
+ * mappings of the moment. Only DOS programs get extended memory, an OS
+ * run in real mode provides its own.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "8086.h"
+#include "extmem.h"
+
+#define FRAMESEG    0xD000      /* EMS page frame */
+#define STUBSEG     0xE000      /* EMS device header, XMS entry */
+#define XMSENTRY    0x0020
+#define EMSPAGE     0x4000
+#define NPHYS       4           /* pages in frame */
+#define MAXHANDLES  64
+#define MAXXMS      63          /* MB, sizes are 16-bit K */
+#define MAXEMS      32          /* MB, as in LIM 4.0 */
+
+bool extendedMemory;
+
+static int xmsKB;
+static int emsPages;
+static int fd = -1;
+static Byte *store;             /* EMS pages, then XMS */
+static Byte *pageUsed;          /* EMS pages allocated */
+static int frame[NPHYS];        /* store page mapped at each, or -1 */
+static bool hmaUsed;
+static int a20Locks;            /* local enables outstanding */
+
+static struct emsHandle {
+    bool used;
+    int pages;
+    int *map;                   /* logical page to store page */
+    bool saved;
+    int savedFrame[NPHYS];
+} emsHandles[MAXHANDLES];
+
+static struct xmsBlock {
+    bool used;
+    unsigned int offset;        /* K into XMS part of store */
+    unsigned int size;          /* K */
+    int locks;
+} xmsBlocks[MAXHANDLES];
+
+static int parseMB(const char *arg, int max)
+{
+    char *end;
+    long mb = strtol(arg, &end, 10);
+
+    if (*end || mb < 0 || mb > max) {
+        errno = EINVAL;
+        return -1;
+    }
+    return mb;
+}
+
+int setXMS(const char *mb)
+{
+    int n = parseMB(mb, MAXXMS);
+
+    if (n < 0)
+        return -1;
+    xmsKB = n << 10;
+    extendedMemory = xmsKB || emsPages;
+    return 0;
+}
+
+int setEMS(const char *mb)
+{
+    int n = parseMB(mb, MAXEMS);
+
+    if (n < 0)
+        return -1;
+    emsPages = n << 6;
+    extendedMemory = xmsKB || emsPages;
+    return 0;
+}
+
+static void createStore(void)
+{
+    size_t size = (size_t)emsPages * EMSPAGE + ((size_t)xmsKB << 10);
+
+    if (sysconf(_SC_PAGESIZE) > EMSPAGE)
+        runtimeError("EMS needs host pages of 16K or less\n");
+    if ((fd = memfd_create("blink16-extmem", MFD_CLOEXEC)) < 0 ||
+        ftruncate(fd, size) < 0)
+        runtimeError("Can't create extended memory: %s\n", strerror(errno));
+    store = mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (store == MAP_FAILED)
+        runtimeError("Can't map extended memory: %s\n", strerror(errno));
+    if (emsPages && !(pageUsed = malloc(emsPages)))
+        runtimeError("Out of memory\n");
+}
+
+/* put a store page in the frame, or fresh memory if page is -1 */
+static void mapPage(int phys, int page)
+{
+    Byte *p = ram + ((DWord)FRAMESEG << 4) + phys * EMSPAGE;
+    void *r;
+
+    if (frame[phys] == page)
+        return;
+    if (page < 0)
+        r = mmap(p, EMSPAGE, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0);
+    else
+        r = mmap(p, EMSPAGE, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_FIXED, fd, (off_t)page * EMSPAGE);
+    if (r == MAP_FAILED)
+        runtimeError("Can't map EMS page: %s\n", strerror(errno));
+    frame[phys] = page;
+    setDirty(p - ram, EMSPAGE);     /* its contents changed under ram */
+}
+
+/* empty the store and set up the drivers, as the DOS loader finishes */
+void installExtendedMemory(void)
+{
+    static const Byte xmsStub[] = {
+        0xeb, 0x03, 0x90, 0x90, 0x90,   /* jmp short, room for hooks */
+        0xcd, INT_XMS,                  /* int INT_XMS */
+        0xcb                            /* retf */
+    };
+    Word saved = es();
+    int i;
+
+    if (!extendedMemory)
+        return;
+    if (fd < 0)
+        createStore();
+    for (i=0; i<NPHYS && emsPages; i++) {
+        frame[i] = 0;           /* whatever is there, replace it */
+        mapPage(i, -1);
+    }
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, 0,
+        (off_t)emsPages * EMSPAGE + ((off_t)xmsKB << 10)) < 0)
+        runtimeError("Can't clear extended memory: %s\n", strerror(errno));
+    for (i=0; i<MAXHANDLES; i++) {
+        free(emsHandles[i].map);
+        memset(&emsHandles[i], 0, sizeof(emsHandles[i]));
+        memset(&xmsBlocks[i], 0, sizeof(xmsBlocks[i]));
+    }
+    emsHandles[0].used = true;          /* the OS handle */
+    hmaUsed = false;
+    a20Locks = 0;
+    if (emsPages)
+        memset(pageUsed, 0, emsPages);
+
+    setES(STUBSEG);
+    setShadowFlags(0, ES, XMSENTRY + sizeof(xmsStub), fRead);
+    if (emsPages) {
+        /* device header found through the INT 67h vector */
+        writeWord(0xffff, 0x00, ES);
+        writeWord(0xffff, 0x02, ES);
+        writeWord(0xc000, 0x04, ES);
+        for (i=0; i<8; i++)
+            writeByte("EMMXXXX0"[i], 0x0a + i, ES);
+        writeByte(0xcf, 0x12, ES);      /* iret */
+        setES(0x0000);
+        setShadowFlags(0x67 * 4, ES, 4, fRead);
+        writeWord(0x0012, 0x67 * 4, ES);
+        writeWord(STUBSEG, 0x67 * 4 + 2, ES);
+        setES(FRAMESEG);
+        setShadowFlags(0, ES, NPHYS * EMSPAGE, fRead|fWrite);
+        setES(STUBSEG);
+    }
+    for (i=0; i<(int)sizeof(xmsStub); i++)
+        writeByte(xmsStub[i], XMSENTRY + i, ES);
+    setES(saved);
+}
+
+/* only taken over when configured, else guest handlers see them */
+bool isExtendedMemoryInterrupt(int intno)
+{
+    if (intno == 0x2f || intno == INT_XMS)
+        return xmsKB != 0;
+    return intno == 0x67 && emsPages;
+}
+
+/* mark conventional memory written by an XMS move as initialized */
+static void setInitialized(DWord a, DWord len)
+{
+    Word saved = es();
+
+    for (; len; a += 0x8000, len -= len > 0x8000 ? 0x8000 : len) {
+        setES(a >> 4);
+        setShadowFlags(a & 15, ES, len > 0x8000 ? 0x8000 : len, fRead|fWrite);
+    }
+    setES(saved);
+}
+
+static bool validXMS(int h)
+{
+    return h > 0 && h < MAXHANDLES && xmsBlocks[h].used;
+}
+
+/* is K offset a free start for size, ignoring block skip */
+static bool xmsFits(unsigned int offset, unsigned int size, int skip)
+{
+    int i;
+
+    if (offset + size > (unsigned)xmsKB)
+        return false;
+    for (i=1; i<MAXHANDLES; i++) {
+        struct xmsBlock *b = &xmsBlocks[i];
+        if (b->used && i != skip && offset < b->offset + b->size &&
+            b->offset < offset + (size ? size : 1))
+            return false;
+    }
+    return true;
+}
+
+/* first fit for size K, or -1 */
+static int xmsFind(unsigned int size, int skip)
+{
+    int i;
+
+    if (xmsFits(0, size, skip))
+        return 0;
+    for (i=1; i<MAXHANDLES; i++) {
+        struct xmsBlock *b = &xmsBlocks[i];
+        if (b->used && i != skip && xmsFits(b->offset + b->size, size, skip))
+            return b->offset + b->size;
+    }
+    return -1;
+}
+
+/* size of free space starting at offset */
+static unsigned int xmsGap(unsigned int offset)
+{
+    unsigned int end = xmsKB;
+    int i;
+
+    for (i=1; i<MAXHANDLES; i++) {
+        struct xmsBlock *b = &xmsBlocks[i];
+        if (!b->used)
+            continue;
+        if (offset >= b->offset && offset < b->offset + b->size)
+            return 0;
+        if (b->offset >= offset && b->offset < end)
+            end = b->offset;
+    }
+    return end - offset;
+}
+
+static void xmsFree(unsigned int *largest, unsigned int *total)
+{
+    unsigned int gap;
+    int i;
+
+    *largest = xmsGap(0);
+    *total = xmsKB;
+    for (i=1; i<MAXHANDLES; i++) {
+        struct xmsBlock *b = &xmsBlocks[i];
+        if (!b->used)
+            continue;
+        *total -= b->size;
+        gap = xmsGap(b->offset + b->size);
+        if (gap > *largest)
+            *largest = gap;
+    }
+}
+
+/* host address of len bytes at handle:offset, or 0 if out of range */
+static Byte *xmsAddress(int h, DWord offset, DWord len)
+{
+    DWord a;
+
+    if (!h) {
+        a = ((offset >> 16) << 4) + (offset & 0xffff);
+        return a + len <= RAMSIZE ? ram + a : 0;
+    }
+    if (offset > ((DWord)xmsBlocks[h].size << 10) ||
+        len > ((DWord)xmsBlocks[h].size << 10) - offset)
+        return 0;
+    return store + (size_t)emsPages * EMSPAGE +
+        ((size_t)xmsBlocks[h].offset << 10) + offset;
+}
+
+static int xmsMove(void)
+{
+    DWord len = readWord(si(), DS) | (DWord)readWord(si() + 2, DS) << 16;
+    int src = readWord(si() + 4, DS);
+    DWord srcOffset = readWord(si() + 6, DS) | (DWord)readWord(si() + 8, DS) << 16;
+    int dst = readWord(si() + 10, DS);
+    DWord dstOffset = readWord(si() + 12, DS) | (DWord)readWord(si() + 14, DS) << 16;
+    Byte *from, *to;
+
+    if (src && !validXMS(src))
+        return 0xa3;
+    if (dst && !validXMS(dst))
+        return 0xa5;
+    if (len & 1)
+        return 0xa7;
+    if (!(from = xmsAddress(src, srcOffset, len)))
+        return 0xa4;
+    if (!(to = xmsAddress(dst, dstOffset, len)))
+        return 0xa6;
+    memmove(to, from, len);
+    if (!dst) {
+        setInitialized(to - ram, len);
+        setDirty(to - ram, len);
+    }
+    return 0;
+}
+
+static void handleXMS(void)
+{
+    unsigned int largest, total;
+    Word saved = es();
+    DWord a;
+    Byte *p;
+    int h = dx(), i, n, error = 0;
+
+    switch (ah()) {
+    case 0x00:                  /* version */
+        setAX(0x0300);
+        setBX(0x0100);
+        setDX(getCPU() == CPU_286);     /* HMA exists */
+        return;
+    case 0x01:                  /* request HMA */
+        if (getCPU() != CPU_286)
+            error = 0x90;
+        else if (hmaUsed)
+            error = 0x91;
+        else {
+            hmaUsed = true;
+            setES(0xffff);
+            setShadowFlags(0x10, ES, 0xfff0, fRead|fWrite);
+            setES(saved);
+        }
+        break;
+    case 0x02:                  /* release HMA */
+        if (getCPU() != CPU_286)
+            error = 0x90;
+        else if (!hmaUsed)
+            error = 0x93;
+        else
+            hmaUsed = false;
+        break;
+    case 0x03:                  /* global enable A20 */
+    case 0x05:                  /* local enable A20 */
+        a20Locks += ah() == 0x05;
+        setA20(true);
+        if (!getA20())
+            error = 0x82;
+        break;
+    case 0x04:                  /* global disable A20 */
+        setA20(false);
+        break;
+    case 0x06:                  /* local disable A20 */
+        if (a20Locks && --a20Locks)
+            error = 0x94;
+        else
+            setA20(false);
+        break;
+    case 0x07:                  /* query A20 */
+        setAX(getA20());
+        setBL(0);
+        return;
+    case 0x08:                  /* query free */
+        xmsFree(&largest, &total);
+        setAX(largest);
+        setDX(total);
+        setBL(total ? 0 : 0xa0);
+        return;
+    case 0x09:                  /* allocate */
+        for (i=1; i<MAXHANDLES && xmsBlocks[i].used; i++)
+            continue;
+        if (i == MAXHANDLES)
+            error = 0xa1;
+        else if ((n = xmsFind(dx(), 0)) < 0)
+            error = 0xa0;
+        else {
+            xmsBlocks[i].used = true;
+            xmsBlocks[i].offset = n;
+            xmsBlocks[i].size = dx();
+            xmsBlocks[i].locks = 0;
+            setDX(i);
+        }
+        break;
+    case 0x0a:                  /* free */
+        if (!validXMS(h))
+            error = 0xa2;
+        else if (xmsBlocks[h].locks)
+            error = 0xab;
+        else
+            xmsBlocks[h].used = false;
+        break;
+    case 0x0b:                  /* move */
+        error = xmsMove();
+        break;
+    case 0x0c:                  /* lock, at an address above the HMA */
+        if (!validXMS(h))
+            error = 0xa2;
+        else if (xmsBlocks[h].locks == 255)
+            error = 0xac;
+        else {
+            xmsBlocks[h].locks++;
+            a = 0x110000 + ((DWord)xmsBlocks[h].offset << 10);
+            setDX(a >> 16);
+            setBX(a);
+        }
+        setAX(!error);
+        if (error)
+            setBL(error);
+        return;
+    case 0x0d:                  /* unlock */
+        if (!validXMS(h))
+            error = 0xa2;
+        else if (!xmsBlocks[h].locks)
+            error = 0xaa;
+        else
+            xmsBlocks[h].locks--;
+        break;
+    case 0x0e:                  /* handle information */
+        if (!validXMS(h)) {
+            error = 0xa2;
+            break;
+        }
+        for (i=1, n=0; i<MAXHANDLES; i++)
+            n += !xmsBlocks[i].used;
+        setBH(xmsBlocks[h].locks);
+        setBL(n);
+        setDX(xmsBlocks[h].size);
+        setAX(1);
+        return;
+    case 0x0f:                  /* reallocate */
+        if (!validXMS(h))
+            error = 0xa2;
+        else if (xmsBlocks[h].locks)
+            error = 0xab;
+        else if (xmsFits(xmsBlocks[h].offset, bx(), h))
+            xmsBlocks[h].size = bx();
+        else if ((n = xmsFind(bx(), h)) < 0)
+            error = 0xa0;
+        else {
+            p = xmsAddress(h, 0, 0);
+            memmove(p + (((long)n - xmsBlocks[h].offset) << 10), p,
+                (size_t)xmsBlocks[h].size << 10);
+            xmsBlocks[h].offset = n;
+            xmsBlocks[h].size = bx();
+        }
+        break;
+    case 0x10:                  /* request UMB */
+        setDX(0);
+        error = 0xb1;
+        break;
+    default:
+        error = 0x80;
+        break;
+    }
+    setAX(!error);
+    if (error)
+        setBL(error);
+}
+
+static bool validEMS(int h)
+{
+    return h >= 0 && h < MAXHANDLES && emsHandles[h].used;
+}
+
+static int emsAllocate(int pages)
+{
+    struct emsHandle *e;
+    int i, h, avail = 0;
+
+    for (i=0; i<emsPages; i++)
+        avail += !pageUsed[i];
+    if (!pages)
+        return 0x89;
+    if (pages > emsPages)
+        return 0x87;
+    if (pages > avail)
+        return 0x88;
+    for (h=1; h<MAXHANDLES && emsHandles[h].used; h++)
+        continue;
+    if (h == MAXHANDLES)
+        return 0x85;
+    e = &emsHandles[h];
+    if (!(e->map = malloc(pages * sizeof(int))))
+        return 0x80;
+    e->used = true;
+    e->pages = pages;
+    e->saved = false;
+    for (i=0; pages; i++) {
+        if (!pageUsed[i]) {
+            pageUsed[i] = 1;
+            e->map[--pages] = i;
+        }
+    }
+    setDX(h);
+    return 0;
+}
+
+static int emsMap(int phys, int logical, int h)
+{
+    if (!validEMS(h))
+        return 0x83;
+    if (phys >= NPHYS)
+        return 0x8b;
+    if (logical == 0xffff)
+        mapPage(phys, -1);
+    else if (logical >= emsHandles[h].pages)
+        return 0x8a;
+    else
+        mapPage(phys, emsHandles[h].map[logical]);
+    return 0;
+}
+
+static int emsDeallocate(int h)
+{
+    struct emsHandle *e = &emsHandles[h];
+    int i, j;
+
+    if (!validEMS(h))
+        return 0x83;
+    if (e->saved)
+        return 0x86;
+    if (!h)
+        return 0;
+    for (i=0; i<e->pages; i++) {
+        for (j=0; j<NPHYS; j++) {
+            if (frame[j] == e->map[i])
+                mapPage(j, -1);
+        }
+        pageUsed[e->map[i]] = 0;
+    }
+    free(e->map);
+    memset(e, 0, sizeof(*e));
+    return 0;
+}
+
+static void handleEMS(void)
+{
+    struct emsHandle *e;
+    int h = dx(), i, n, error = 0;
+
+    switch (ah()) {
+    case 0x40:                  /* status */
+        break;
+    case 0x41:                  /* page frame segment */
+        setBX(FRAMESEG);
+        break;
+    case 0x42:                  /* page counts */
+        for (i=n=0; i<emsPages; i++)
+            n += !pageUsed[i];
+        setBX(n);
+        setDX(emsPages);
+        break;
+    case 0x43:                  /* allocate */
+        error = emsAllocate(bx());
+        break;
+    case 0x44:                  /* map or unmap */
+        error = emsMap(al(), bx(), h);
+        break;
+    case 0x45:                  /* deallocate */
+        error = emsDeallocate(h);
+        break;
+    case 0x46:                  /* version */
+        setAL(0x40);
+        break;
+    case 0x47:                  /* save page map */
+        if (!validEMS(h))
+            error = 0x83;
+        else if (emsHandles[h].saved)
+            error = 0x8d;
+        else {
+            emsHandles[h].saved = true;
+            memcpy(emsHandles[h].savedFrame, frame, sizeof(frame));
+        }
+        break;
+    case 0x48:                  /* restore page map */
+        if (!validEMS(h))
+            error = 0x83;
+        else if (!emsHandles[h].saved)
+            error = 0x8e;
+        else {
+            emsHandles[h].saved = false;
+            for (i=0; i<NPHYS; i++)
+                mapPage(i, emsHandles[h].savedFrame[i]);
+        }
+        break;
+    case 0x4b:                  /* open handles */
+        for (i=n=0; i<MAXHANDLES; i++)
+            n += emsHandles[i].used;
+        setBX(n);
+        break;
+    case 0x4c:                  /* pages of handle */
+        if (!validEMS(h))
+            error = 0x83;
+        else
+            setBX(emsHandles[h].pages);
+        break;
+    case 0x4d:                  /* pages of all handles at ES:DI */
+        for (i=n=0; i<MAXHANDLES; i++) {
+            e = &emsHandles[i];
+            if (e->used) {
+                writeWord(i, di() + n * 4, ES);
+                writeWord(e->pages, di() + n * 4 + 2, ES);
+                n++;
+            }
+        }
+        setBX(n);
+        break;
+    default:
+        error = 0x84;
+        break;
+    }
+    setAH(error);
+}
+
+bool handleExtendedMemory(int intno)
+{
+    switch (intno) {
+    case 0x2f:                  /* other multiplex calls aren't answered */
+        if (ax() == 0x4300)
+            setAL(0x80);
+        else if (ax() == 0x4310) {
+            setES(STUBSEG);
+            setBX(XMSENTRY);
+        }
+        break;
+    case 0x67:
+        handleEMS();
+        break;
+    case INT_XMS:
+        handleXMS();
+        break;
+    }
+    return true;
+}
@@ -0,0 +1,17 @@
+#ifndef EXTMEM_H_
+#define EXTMEM_H_
+/* XMS and EMS memory for DOS programs */
+
+#include <stdbool.h>
+
+#define INT_XMS     0xfe        /* XMS driver entry traps here */
+
+extern bool extendedMemory;
+
+int setXMS(const char *mb);
+int setEMS(const char *mb);
+void installExtendedMemory(void);
+bool isExtendedMemoryInterrupt(int intno);
+bool handleExtendedMemory(int intno);
+
+#endif
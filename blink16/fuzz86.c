@@ -0,0 +1,388 @@
+/*
+ * Differential fuzzer for the 8086 emulator core
+ *
+ * Usage: fuzz86 [-v] [-n cases] [-k steps] [-s seed]
+ *
+ * Runs random instruction sequences from random machine states through
+ * two 8086 cores: 8086.c in the tree, and the reference in fuzzref/,
+ * a frozen copy of the core from before table dispatch, built with its
+ * global symbols renamed ref_. Both share the stubbed devices below.
+ * After each case the registers, flags, all of memory including the
+ * HMA, port output and any runtime error must be identical, so a faster
+ * core can be checked against the plain one. The reference has no RAM
+ * above 1M, so there it is taken as unchanged. It is an 8086 only, so
+ * the 80186 and 80286 models aren't checked. A mismatch is minimized, first to the instruction where
+ * the cores diverge, then by clearing registers and flags that don't
+ * matter to it, and printed disassembled. Exits 1 on a mismatch.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include "8086.h"
+#include "exe.h"
+#include "sched.h"
+#include "timing.h"
+#include "devices.h"
+#include "trace.h"
+#include "counters.h"
+#include "disasm.h"
+
+#define CODESIZE    16          /* random bytes placed at CS:IP */
+#define FLAGMASK    0x0ed5      /* CF PF AF ZF SF IF DF OF */
+
+/* one build of the core */
+struct core {
+    const char *name;
+    Word *regs;
+    Byte *ram;
+    DWord ramsize;
+    void (*initMachine)(struct exe *e);
+    void (*initExecute)(void);
+    void (*executeInstruction)(void);
+    bool (*inInstruction)(void);
+    void (*setShadowCheck)(bool on);
+    Word (*getIP)(void);
+    void (*setIP)(Word w);
+    Word (*getFlags)(void);
+    void (*setFlags)(Word w);
+};
+
+extern Word ref_registers[12];
+extern Byte ref_ram[RAMSIZE];
+void ref_initMachine(struct exe *e);
+void ref_initExecute(void);
+void ref_executeInstruction(void);
+bool ref_inInstruction(void);
+void ref_setShadowCheck(bool on);
+Word ref_getIP(void);
+void ref_setIP(Word w);
+Word ref_getFlags(void);
+void ref_setFlags(Word w);
+
+static struct core test = {
+    "test", regs.w, ram, MEMSIZE, initMachine, initExecute,
+    executeInstruction, inInstruction, setShadowCheck,
+    getIP, setIP, getFlags, setFlags
+};
+static struct core ref = {
+    "ref", ref_registers, ref_ram, RAMSIZE, ref_initMachine, ref_initExecute,
+    ref_executeInstruction, ref_inInstruction, ref_setShadowCheck,
+    ref_getIP, ref_setIP, ref_getFlags, ref_setFlags
+};
+
+struct state {
+    Word regs[12];
+    Word ip;
+    Word flags;
+};
+
+struct testcase {
+    struct state s;
+    int steps;
+    Byte *ram;
+};
+
+struct outcome {
+    struct state s;
+    bool inInstruction;
+    int steps;                  /* completed before any error */
+    unsigned long ports;        /* hash of port output */
+    char error[128];
+    Byte *ram;                  /* the core's own, until it runs again */
+    Byte *hma;                  /* its HMA, or the case's if it has none */
+};
+
+static const char *regnames[12] = {
+    "ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "es", "cs", "ss", "ds"
+};
+static int verbose;
+static struct exe exe;
+static jmp_buf stopped;
+static struct outcome *current;
+static Byte *disram;
+
+/* emulator callouts and devices, shared by both cores */
+Clock cpuClock;
+Clock nextEvent = (Clock)-1;
+bool irqPending;
+bool timing;
+bool tracing;
+struct counters counters;
+_Thread_local struct Machine *g_machine;
+
+void runtimeError(const char *msg, ...)
+{
+    va_list args;
+
+    va_start(args, msg);
+    vsnprintf(current->error, sizeof(current->error), msg, args);
+    va_end(args);
+    longjmp(stopped, 1);
+}
+
+bool canHandleInterrupt(struct exe *e, int intno) { return false; }
+static bool checkStack(struct exe *e) { return false; }
+
+bool handleInterrupt(struct exe *e, int intno)
+{
+    snprintf(current->error, sizeof(current->error), "interrupt %d", intno);
+    longjmp(stopped, 1);
+}
+
+uint8_t inPortByte(uint16_t port) { return port * 7 + 3; }
+
+void outPortByte(uint16_t port, uint8_t value)
+{
+    current->ports = current->ports * 31 + (port << 8 | value);
+}
+
+void SetReadAddr(struct Machine *m, int64_t addr, uint32_t size) {}
+void SetWriteAddr(struct Machine *m, int64_t addr, uint32_t size) {}
+void addState(void *p, size_t size) {}
+void initPorts(void) {}
+void initScheduler(void) {}
+void initPIC(void) {}
+void initPIT(void) {}
+void initUART(void) {}
+void initA20(void) {}
+void resetTiming(void) {}
+void runEvents(void) {}
+bool idleUntilEvent(void) { return false; }
+int picAcknowledge(void) { return 0; }
+bool picUnmasked(void) { return false; }
+void chargeInstruction(const struct insnTiming *t) {}
+void chargeInterrupt(const struct insnTiming *t) {}
+void traceWrite(uint32_t addr, uint8_t value) {}
+void traceInstruction(uint16_t cs, uint16_t ip, int length, bool interrupt) {}
+
+static unsigned int random16(void)
+{
+    return (random() >> 8) & 0xffff;
+}
+
+/* run a case for some steps on a core, leaving its results in o */
+static void run(struct core *c, struct testcase *t, int steps, struct outcome *o)
+{
+    int i;
+
+    memset(o, 0, sizeof(*o));
+    current = o;
+    c->initMachine(&exe);
+    c->setShadowCheck(false);
+    memcpy(c->ram, t->ram, c->ramsize);
+    memcpy(c->regs, t->s.regs, sizeof(t->s.regs));
+    c->setIP(t->s.ip);
+    c->setFlags(t->s.flags);
+    c->initExecute();
+    if (!setjmp(stopped)) {
+        for (i=0; i<steps; i++, o->steps++)
+            c->executeInstruction();
+    }
+    memcpy(o->s.regs, c->regs, sizeof(o->s.regs));
+    o->s.ip = c->getIP();
+    o->s.flags = c->getFlags();
+    o->inInstruction = c->inInstruction();
+    o->ram = c->ram;
+    o->hma = c->ramsize == MEMSIZE ? c->ram + RAMSIZE : t->ram + RAMSIZE;
+}
+
+static Byte memoryAt(struct outcome *o, DWord a)
+{
+    return a < RAMSIZE ? o->ram[a] : o->hma[a - RAMSIZE];
+}
+
+static bool same(struct outcome *a, struct outcome *b)
+{
+    return !memcmp(&a->s, &b->s, sizeof(a->s)) &&
+        a->inInstruction == b->inInstruction && a->steps == b->steps &&
+        a->ports == b->ports && !strcmp(a->error, b->error) &&
+        !memcmp(a->ram, b->ram, RAMSIZE) &&
+        !memcmp(a->hma, b->hma, MEMSIZE - RAMSIZE);
+}
+
+static bool fails(struct testcase *t, struct outcome *a, struct outcome *b)
+{
+    run(&test, t, t->steps, a);
+    run(&ref, t, t->steps, b);
+    return !same(a, b);
+}
+
+/*
+ * Shrink a failing case: find the step at which the cores diverge,
+ * start from the last instruction boundary before it, then clear
+ * whatever registers and flags the failure doesn't depend on.
+ */
+static void minimize(struct testcase *t, struct outcome *a, struct outcome *b)
+{
+    int k, j, i;
+    Word saved;
+
+    for (k=1; k<t->steps; k++) {
+        run(&test, t, k, a);
+        run(&ref, t, k, b);
+        if (!same(a, b))
+            break;
+    }
+    for (j=k-1; j>0; j--) {
+        run(&ref, t, j, b);
+        if (!b->inInstruction && !b->error[0])
+            break;
+    }
+    if (j > 0) {
+        memcpy(t->ram, b->ram, RAMSIZE);
+        if (b->hma != t->ram + RAMSIZE)
+            memcpy(t->ram + RAMSIZE, b->hma, MEMSIZE - RAMSIZE);
+        t->s = b->s;
+    }
+    t->steps = k - j;
+    for (i=0; i<12; i++) {
+        if (i == 9 || !t->s.regs[i])    /* keep CS */
+            continue;
+        saved = t->s.regs[i];
+        t->s.regs[i] = 0;
+        if (!fails(t, a, b))
+            t->s.regs[i] = saved;
+    }
+    for (i=1; i<=FLAGMASK; i<<=1) {
+        if (!(t->s.flags & i))
+            continue;
+        t->s.flags &= ~i;
+        if (!fails(t, a, b))
+            t->s.flags |= i;
+    }
+    fails(t, a, b);
+}
+
+static int nextbyte(int cs, int ip)
+{
+    return disram[(((unsigned)cs << 4) + (unsigned short)ip) & (RAMSIZE - 1)];
+}
+
+static void printState(const char *name, struct state *s)
+{
+    int i;
+
+    printf("%-6s", name);
+    for (i=0; i<12; i++)
+        printf(" %s=%04x", regnames[i], s->regs[i]);
+    printf(" ip=%04x flags=%04x\n", s->ip, s->flags);
+}
+
+static void printOutcome(struct core *c, struct outcome *o, struct outcome *other)
+{
+    int i, n;
+
+    printf("%-6s", c->name);
+    for (i=0; i<12; i++) {
+        if (o->s.regs[i] != other->s.regs[i])
+            printf(" %s=%04x", regnames[i], o->s.regs[i]);
+    }
+    if (o->s.ip != other->s.ip)
+        printf(" ip=%04x", o->s.ip);
+    if (o->s.flags != other->s.flags)
+        printf(" flags=%04x", o->s.flags);
+    if (o->inInstruction != other->inInstruction)
+        printf(" %s", o->inInstruction ? "mid-instruction" : "at boundary");
+    if (o->steps != other->steps)
+        printf(" stopped at step %d", o->steps);
+    if (o->ports != other->ports)
+        printf(" ports=%08lx", o->ports);
+    if (strcmp(o->error, other->error))
+        printf(" error \"%s\"", o->error);
+    for (i=n=0; i<MEMSIZE && n<8; i++) {
+        if (memoryAt(o, i) != memoryAt(other, i)) {
+            printf(" [%05x]=%02x", i, memoryAt(o, i));
+            n++;
+        }
+    }
+    printf("\n");
+}
+
+static void report(unsigned long n, struct testcase *t, struct outcome *a,
+    struct outcome *b)
+{
+    struct dis d;
+    int i, ip = t->s.ip;
+
+    printf("case %lu: mismatch after %d step%s\n", n, t->steps,
+        t->steps == 1 ? "" : "s");
+    printState("before", &t->s);
+    memset(&d, 0, sizeof(d));
+    disram = t->ram;
+    for (i=0; i<t->steps && i<8; i++) {
+        ip = disasm(&d, t->s.regs[9], ip, nextbyte, t->s.regs[11],
+            fDisCS | fDisIP | fDisBytes | fDisInst);
+        printf("  %s\n", d.buf);
+    }
+    printOutcome(&test, a, b);
+    printOutcome(&ref, b, a);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: fuzz86 [-v] [-n cases] [-k steps] [-s seed]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct testcase t;
+    struct outcome a, b;
+    unsigned long cases = 10000, n, seed = 1;
+    unsigned int i, addr;
+    int ch, steps = 8;
+
+    while ((ch = getopt(argc, argv, "vn:k:s:")) != -1) {
+        switch (ch) {
+        case 'v':
+            verbose = 1;
+            break;
+        case 'n':
+            cases = strtoul(optarg, NULL, 0);
+            break;
+        case 'k':
+            steps = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (steps < 1)
+        usage();
+    if (!(t.ram = malloc(MEMSIZE))) {
+        fprintf(stderr, "fuzz86: out of memory\n");
+        return 1;
+    }
+    exe.checkStack = checkStack;
+    srandom(seed);
+    for (i=0; i<MEMSIZE; i++)
+        t.ram[i] = random() >> 16;
+    for (n=0; n<cases; n++) {
+        for (i=0; i<8; i++)
+            t.s.regs[i] = random16();
+        for (i=8; i<12; i++)        /* keep most of each segment in RAM */
+            t.s.regs[i] = random16() % 0xf000;
+        t.s.ip = random16();
+        t.s.flags = random16() & FLAGMASK;
+        t.steps = steps;
+        for (i=0; i<CODESIZE; i++) {
+            addr = ((t.s.regs[9] << 4) + (Word)(t.s.ip + i)) & (RAMSIZE - 1);
+            t.ram[addr] = random() >> 16;
+        }
+        if (verbose)
+            printState("case", &t.s);
+        if (fails(&t, &a, &b)) {
+            minimize(&t, &a, &b);
+            report(n, &t, &a, &b);
+            return 1;
+        }
+    }
+    printf("%lu cases of %d steps, no mismatches\n", cases, steps);
+    return 0;
+}
@@ -0,0 +1,467 @@
+/*
+ * GDB remote serial protocol stub for 8086 emulator
+ *
+ * With --gdb, blink16 listens on a local TCP port, or a Unix socket if
+ * given a path, and waits for GDB before the first instruction. GDB has
+ * no 8086 target, so registers are presented as the i386 core set with
+ * 16-bit values zero extended, except that EIP holds the linear address
+ * of CS:IP so $pc, breakpoints and disassembly agree. Setting it moves
+ * IP within CS. Use "set architecture i8086" for 16-bit disassembly.
+ * Memory addresses are linear. Breakpoints are bits in a map of memory
+ * that the run loop tests before each instruction, so between stops the
+ * emulator runs at full speed, polling for a GDB interrupt now and then.
+ * A runtime error stops with SIGSEGV so the state can be looked at, and
+ * the emulator exits when GDB continues.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "8086.h"
+#include "gdbstub.h"
+
+#define MAXPACKET   4096
+#define NREGS       16          /* i386 core: eax ... eip eflags cs ... gs */
+#define SIGINT_GDB  2
+#define SIGTRAP_GDB 5
+#define SIGSEGV_GDB 11
+
+bool gdbAttached;
+bool gdbStepping;
+Byte gdbBreaks[MEMSIZE / 8];
+
+static int listener = -1;
+static int fd = -1;
+static int lastSignal = SIGTRAP_GDB;
+static bool interrupted;
+static char packet[MAXPACKET];
+static char reply[MAXPACKET];
+
+static void sendExit(int status, void *arg);
+
+int startGdb(const char *spec)
+{
+    struct sockaddr_un un;
+    struct sockaddr_in in;
+    const char *colon;
+    int on = 1;
+
+    if (strchr(spec, '/')) {
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        if (strlen(spec) >= sizeof(un.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy(un.sun_path, spec);
+        unlink(spec);
+        if ((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+            bind(listener, (struct sockaddr *)&un, sizeof(un)) < 0)
+            return -1;
+    } else {
+        memset(&in, 0, sizeof(in));
+        in.sin_family = AF_INET;
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        colon = strrchr(spec, ':');
+        in.sin_port = htons(atoi(colon ? colon + 1 : spec));
+        if (colon && colon > spec) {
+            char host[64];
+            snprintf(host, sizeof(host), "%.*s", (int)(colon - spec), spec);
+            if (inet_pton(AF_INET, host, &in.sin_addr) != 1) {
+                errno = EINVAL;
+                return -1;
+            }
+        }
+        if (!in.sin_port) {
+            errno = EINVAL;
+            return -1;
+        }
+        if ((listener = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+            return -1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(listener, (struct sockaddr *)&in, sizeof(in)) < 0)
+            return -1;
+    }
+    if (listen(listener, 1) < 0)
+        return -1;
+    gdbAttached = true;
+    gdbStepping = true;         /* stop at the first instruction */
+    on_exit(sendExit, 0);
+    return 0;
+}
+
+static void waitForGdb(void)
+{
+    int on = 1;
+
+    fprintf(stderr, "blink16: waiting for gdb\n");
+    if ((fd = accept(listener, 0, 0)) < 0) {
+        perror("gdb");
+        exit(1);
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    close(listener);
+    listener = -1;
+}
+
+static void detach(void)
+{
+    close(fd);
+    fd = -1;
+    gdbAttached = gdbStepping = false;
+    memset(gdbBreaks, 0, sizeof(gdbBreaks));
+}
+
+static int getChar(void)
+{
+    unsigned char c;
+
+    if (read(fd, &c, 1) != 1) {
+        detach();
+        return -1;
+    }
+    return c;
+}
+
+static int hexDigit(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/* read a packet into packet[], acknowledging it, false if GDB went */
+static bool getPacket(void)
+{
+    int c, n, sum, check;
+
+    for (;;) {
+        while ((c = getChar()) != '$') {
+            if (c < 0)
+                return false;
+        }
+        for (n=sum=0; (c = getChar()) != '#'; sum += c) {
+            if (c < 0)
+                return false;
+            if (n < MAXPACKET - 1)
+                packet[n++] = c;
+        }
+        packet[n] = 0;
+        check = hexDigit(getChar()) << 4;
+        check |= hexDigit(getChar());
+        if (fd < 0)
+            return false;
+        if ((sum & 0xff) == check) {
+            write(fd, "+", 1);
+            return true;
+        }
+        write(fd, "-", 1);
+    }
+}
+
+static void putPacket(const char *s)
+{
+    static char buf[MAXPACKET + 4];
+    int n, sum = 0;
+
+    if (fd < 0)
+        return;
+    n = snprintf(buf, sizeof(buf) - 3, "$%s", s);
+    for (s=buf+1; *s; s++)
+        sum += *s;
+    n += sprintf(buf + n, "#%02x", sum & 0xff);
+    write(fd, buf, n);
+}
+
+static void sendExit(int status, void *arg)
+{
+    char s[8];
+
+    if (fd >= 0) {
+        snprintf(s, sizeof(s), "W%02x", status & 0xff);
+        putPacket(s);
+    }
+}
+
+static unsigned long parseHex(const char **p)
+{
+    unsigned long v = 0;
+    int d;
+
+    while ((d = hexDigit(**p)) >= 0) {
+        v = v << 4 | d;
+        (*p)++;
+    }
+    return v;
+}
+
+static char *putHex32(char *p, DWord v)
+{
+    int i;
+
+    for (i=0; i<4; i++, v >>= 8)
+        p += sprintf(p, "%02x", v & 0xff);
+    return p;
+}
+
+static DWord getHex32(const char **p)
+{
+    DWord v = 0;
+    int i, hi, lo;
+
+    for (i=0; i<4; i++) {
+        if ((hi = hexDigit((*p)[0])) < 0 || (lo = hexDigit((*p)[1])) < 0)
+            break;
+        v |= (DWord)(hi << 4 | lo) << (i * 8);
+        *p += 2;
+    }
+    return v;
+}
+
+static DWord getRegister(int n)
+{
+    static const int segs[4] = { 9, 10, 11, 8 };    /* cs ss ds es */
+
+    if (n < 8)                  /* eax ... edi are in regs order */
+        return regs.w[n];
+    if (n == 8)
+        return ((DWord)cs() << 4) + getIP();
+    if (n == 9)
+        return getFlags();
+    if (n < 14)
+        return regs.w[segs[n - 10]];
+    return 0;
+}
+
+/* set a register, EIP last so it is taken within the new CS */
+static void setRegister(int n, DWord v)
+{
+    static const int segs[4] = { 9, 10, 11, 8 };
+
+    if (n < 8)
+        regs.w[n] = v;
+    else if (n == 8)
+        setIP(v - ((DWord)cs() << 4));
+    else if (n == 9)
+        setFlags(v);
+    else if (n < 14)
+        regs.w[segs[n - 10]] = v;
+}
+
+static void readRegisters(void)
+{
+    char *p = reply;
+    int i;
+
+    for (i=0; i<NREGS; i++)
+        p = putHex32(p, getRegister(i));
+    putPacket(reply);
+}
+
+static void writeRegisters(const char *p)
+{
+    DWord v[NREGS];
+    int i, n;
+
+    for (n=0; n<NREGS && *p; n++)
+        v[n] = getHex32(&p);
+    for (i=0; i<n; i++) {
+        if (i != 8)
+            setRegister(i, v[i]);
+    }
+    if (n > 8)
+        setRegister(8, v[8]);
+    putPacket("OK");
+}
+
+static bool memoryRange(DWord addr, DWord len)
+{
+    return addr < MEMSIZE && len <= MEMSIZE - addr && len * 2 < MAXPACKET;
+}
+
+static void readMemory(const char *p)
+{
+    DWord addr = parseHex(&p), len, i;
+    char *q = reply;
+
+    if (*p++ != ',' || !memoryRange(addr, len = parseHex(&p))) {
+        putPacket("E01");
+        return;
+    }
+    for (i=0; i<len; i++)
+        q += sprintf(q, "%02x", ram[wrapA20(addr + i)]);
+    *q = 0;
+    putPacket(reply);
+}
+
+static void writeMemory(const char *p)
+{
+    DWord addr = parseHex(&p), len, i;
+    int hi, lo;
+
+    if (*p++ != ',' || !memoryRange(addr, len = parseHex(&p)) || *p++ != ':') {
+        putPacket("E01");
+        return;
+    }
+    for (i=0; i<len; i++, p += 2) {
+        if ((hi = hexDigit(p[0])) < 0 || (lo = hexDigit(p[1])) < 0) {
+            putPacket("E01");
+            return;
+        }
+        ram[wrapA20(addr + i)] = hi << 4 | lo;
+        setDirty(wrapA20(addr + i), 1);
+    }
+    putPacket("OK");
+}
+
+/* Z0 and Z1 set breakpoints, z0 and z1 clear them */
+static void breakpoint(const char *p, bool set)
+{
+    DWord addr;
+
+    if ((*p != '0' && *p != '1') || p[1] != ',') {
+        putPacket("");
+        return;
+    }
+    p += 2;
+    if ((addr = parseHex(&p)) >= MEMSIZE) {
+        putPacket("E01");
+        return;
+    }
+    if (set)
+        gdbBreaks[addr >> 3] |= 1 << (addr & 7);
+    else
+        gdbBreaks[addr >> 3] &= ~(1 << (addr & 7));
+    putPacket("OK");
+}
+
+static void stopReply(void)
+{
+    char s[8];
+
+    snprintf(s, sizeof(s), "S%02x", lastSignal);
+    putPacket(s);
+}
+
+/* serve GDB until it continues or steps, returning true, or detaches */
+static bool serve(void)
+{
+    const char *p;
+
+    while (getPacket()) {
+        p = packet + 1;
+        switch (packet[0]) {
+        case '?':
+            stopReply();
+            break;
+        case 'g':
+            readRegisters();
+            break;
+        case 'G':
+            writeRegisters(p);
+            break;
+        case 'p':
+            putHex32(reply, getRegister(parseHex(&p)));
+            putPacket(reply);
+            break;
+        case 'P': {
+            int n = parseHex(&p);
+            if (*p++ != '=') {
+                putPacket("E01");
+                break;
+            }
+            setRegister(n, getHex32(&p));
+            putPacket("OK");
+            break;
+        }
+        case 'm':
+            readMemory(p);
+            break;
+        case 'M':
+            writeMemory(p);
+            break;
+        case 'Z':
+            breakpoint(p, true);
+            break;
+        case 'z':
+            breakpoint(p, false);
+            break;
+        case 'c':
+        case 's':
+            if (*p)
+                setRegister(8, parseHex(&p));
+            gdbStepping = packet[0] == 's';
+            return true;
+        case 'D':
+            putPacket("OK");
+            detach();
+            return false;
+        case 'k':
+            detach();
+            exit(0);
+        case 'H':
+            putPacket("OK");
+            break;
+        case 'q':
+            if (!strncmp(p, "Supported", 9)) {
+                snprintf(reply, sizeof(reply), "PacketSize=%x", MAXPACKET);
+                putPacket(reply);
+            } else if (!strcmp(p, "Attached"))
+                putPacket("1");
+            else if (!strcmp(p, "C"))
+                putPacket("QC1");
+            else
+                putPacket("");
+            break;
+        default:
+            putPacket("");
+            break;
+        }
+    }
+    return false;
+}
+
+/* report a stop to GDB and serve it until told to go on */
+void gdbStop(void)
+{
+    lastSignal = interrupted ? SIGINT_GDB : SIGTRAP_GDB;
+    interrupted = false;
+    if (fd < 0)
+        waitForGdb();           /* GDB asks why with '?' */
+    else
+        stopReply();            /* answers its 'c' or 's' */
+    serve();
+}
+
+/* stop on a runtime error, exiting once GDB lets go */
+void gdbFault(void)
+{
+    lastSignal = SIGSEGV_GDB;
+    if (fd < 0)
+        waitForGdb();
+    else
+        stopReply();
+    serve();
+}
+
+/* look for an interrupt from GDB without waiting */
+void gdbPoll(void)
+{
+    unsigned char c;
+
+    if (fd >= 0 && recv(fd, &c, 1, MSG_DONTWAIT) == 1 && c == 0x03) {
+        interrupted = true;
+        gdbStepping = true;
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef GDBSTUB_H_
+#define GDBSTUB_H_
+/* GDB remote serial protocol stub for 8086 emulator, include after 8086.h */
+
+#include <stdbool.h>
+
+extern bool gdbAttached;
+extern bool gdbStepping;            /* stop before the next instruction */
+extern Byte gdbBreaks[MEMSIZE / 8]; /* breakpoints by linear address */
+
+int startGdb(const char *spec);
+void gdbStop(void);
+void gdbFault(void);
+void gdbPoll(void);
+
+/* test before each instruction at linear address a */
+static inline bool gdbBreak(DWord a)
+{
+    return gdbStepping || (gdbBreaks[a >> 3] >> (a & 7) & 1);
+}
+
+#endif
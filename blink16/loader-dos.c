@@ -13,6 +13,8 @@
 #include <sys/stat.h>
 #include "8086.h"
 #include "exe.h"
+#include "extmem.h"
+#include "exefile.h"
 
 extern int f_verbose;
 Word loadSegment;       // FIXME remove as global
@@ -99,14 +101,11 @@ static void load_bios_values(void)
 void loadExecutableDOS(struct exe *e, const char *path, int argc, char **argv, char **envp)
 {
     int comfile = 0;
-    struct stat sbuf;
 
-    int fd = open(path, O_RDONLY);
-    if (fd < 0)
+    struct exeFile *f = mapExecutable(path);
+    if (!f)
         loadError("Can't open %s\n", path);
-    if (fstat(fd, &sbuf) < 0)
-        loadError("Can't stat %s\n", path);
-    size_t filesize = sbuf.st_size;
+    size_t filesize = f->size;
     char *p = strrchr(path, '.');
     if (p)
         comfile = !strncmp(p, ".com", 5);
@@ -118,9 +117,8 @@ void loadExecutableDOS(struct exe *e, const char *path, int argc, char **argv, c
     if (filesize > RAMSIZE - loadOffset)
         loadError("Not enough memory to load %s, needs %d bytes have %d\n",
             path, filesize, RAMSIZE);
-    if (read(fd, &ram[loadOffset], filesize) != filesize)
-        loadError("Error reading executable: %s\n", path);
-    close(fd);
+    memcpy(&ram[loadOffset], f->map, filesize);
+    releaseExecutable(f);
 
     write_environ(argc, argv, envp);
     struct image_dos_header *hdr = (struct image_dos_header *)&ram[loadOffset];
@@ -194,6 +192,7 @@ void loadExecutableDOS(struct exe *e, const char *path, int argc, char **argv, c
     }
 #endif
     load_bios_values();
+    installExtendedMemory();
 
     if (f_verbose) printf("CS:IP %04x:%04x DS %04x SS:SP %04x:%04x\n",
         cs(), getIP(), ds(), ss(), sp());
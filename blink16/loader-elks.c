@@ -1,6 +1,13 @@
 /*
  * ELKS a.out executable loader for 8086 emulator
  *
+ * The executable is mapped through the loader file cache and sections
+ * are copied out of the mapping. Compressed sections are decrunched at
+ * load. If BLINK16_CACHE names a directory, decrunched images are kept
+ * there keyed by a hash of the executable file, and later loads of the
+ * same file copy them back. The symbol table is copied out too, as the
+ * mapping may be reused once the load is done.
+ *
  * Greg Haerr
  */
 #include <stdio.h>
@@ -9,10 +16,14 @@
 #include <errno.h>
 #include <string.h>
 #include <stdarg.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include "8086.h"
 #include "exe.h"
+#include "decompress.h"
+#include "exefile.h"
+#include "syms.h"
 
 extern int f_verbose;
 
@@ -123,37 +134,188 @@ static void load_bios_values(void)
 {
 }
 
+/* take the next n bytes of a mapped file */
+static const unsigned char *take(struct exeFile *f, size_t *pos, size_t n,
+    const char *path)
+{
+    const unsigned char *p = f->map + *pos;
+
+    if (n > f->size - *pos)
+        loadError("Error reading executable: %s\n", path);
+    *pos += n;
+    return p;
+}
+
+static void copySection(struct exeFile *f, size_t *pos, unsigned int seg,
+    unsigned int size, const char *path)
+{
+    if (size > RAMSIZE - (seg << 4))
+        loadError("Not enough memory to load %s\n", path);
+    memcpy(&ram[seg << 4], take(f, pos, size, path), size);
+}
+
+/* load a section stored compressed in csize bytes, or raw if csize is 0 */
+static void loadSection(struct exeFile *f, size_t *pos, unsigned int seg,
+    unsigned int size, unsigned int csize, const char *path)
+{
+    if (!csize) {
+        copySection(f, pos, seg, size, path);
+        return;
+    }
+    if (size > RAMSIZE - (seg << 4))
+        loadError("Not enough memory to load %s\n", path);
+    if (exoDecrunch(take(f, pos, csize, path), csize, &ram[seg << 4], size) < 0)
+        loadError("Bad compressed section: %s\n", path);
+}
+
+/* name of decompression cache file from hash of executable */
+static char *cacheName(struct exeFile *f)
+{
+    static char name[PATH_MAX];
+    const char *dir = getenv("BLINK16_CACHE");
+
+    if (!dir || !*dir)
+        return NULL;
+    snprintf(name, sizeof(name), "%s/%016llx.elks", dir,
+        (unsigned long long)hashExecutable(f));
+    return name;
+}
+
+/* copy decrunched text, far text and data from cache, false if absent */
+static bool readCache(const char *name, struct exe *e)
+{
+    struct exeFile *f = mapExecutable(name);
+    size_t pos = 0;
+
+    if (!f)
+        return false;
+    if (f->size != e->aout.tseg + e->eshdr.esh_ftseg + e->aout.dseg) {
+        releaseExecutable(f);
+        return false;
+    }
+    copySection(f, &pos, e->textseg, e->aout.tseg, name);
+    if (e->ftextseg)
+        copySection(f, &pos, e->ftextseg, e->eshdr.esh_ftseg, name);
+    copySection(f, &pos, e->dataseg, e->aout.dseg, name);
+    releaseExecutable(f);
+    return true;
+}
+
+static void writeCache(const char *name, struct exe *e)
+{
+    char tmp[PATH_MAX];
+    int fd;
+    bool ok;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", name, getpid());
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        return;
+    ok = write(fd, &ram[e->textseg << 4], e->aout.tseg) == e->aout.tseg &&
+        (!e->ftextseg || write(fd, &ram[e->ftextseg << 4], e->eshdr.esh_ftseg) ==
+            e->eshdr.esh_ftseg) &&
+        write(fd, &ram[e->dataseg << 4], e->aout.dseg) == e->aout.dseg;
+    close(fd);
+    if (!ok || rename(tmp, name) < 0)
+        unlink(tmp);
+}
+
+/* apply relocations following the sections to the section at place */
+static void relocate(struct exeFile *f, size_t *pos, Word place,
+    unsigned int rsize, struct exe *e, const char *path)
+{
+    struct minix_reloc r;
+    Word value;
+    DWord a;
+
+    for (; rsize >= sizeof(r); rsize -= sizeof(r)) {
+        if (sizeof(r) > f->size - *pos)
+            loadError("Error reading relocations: %s\n", path);
+        memcpy(&r, take(f, pos, sizeof(r), path), sizeof(r));
+        if (r.r_type != R_SEGWORD)
+            loadError("Bad relocation type %d: %s\n", r.r_type, path);
+        switch ((int16_t)r.r_symndx) {
+        case S_TEXT:    value = e->textseg;  break;
+        case S_FTEXT:   value = e->ftextseg; break;
+        case S_DATA:    value = e->dataseg;  break;
+        default:
+            loadError("Bad relocation symbol %d: %s\n", (int16_t)r.r_symndx, path);
+        }
+        if (f_verbose)
+            printf("reloc %04x:%04x = %04x\n", place, (Word)r.r_vaddr, value);
+        a = ((DWord)place << 4) + (Word)r.r_vaddr;
+        if (a + 1 >= RAMSIZE)
+            loadError("Bad relocation address %04x: %s\n", (Word)r.r_vaddr, path);
+        ram[a] = value;
+        ram[a + 1] = value >> 8;
+    }
+}
+
 void loadExecutableElks(struct exe *e, const char *path, int argc, char **argv, char **envp)
 {
     Word loadSegment;
-    struct stat sbuf;
+    size_t pos = 0;
 
-    int fd = open(path, O_RDONLY);
-    if (fd < 0)
+    struct exeFile *f = mapExecutable(path);
+    if (!f)
         loadError("Can't open %s\n", path);
-    if (read(fd, &e->aout, sizeof(e->aout)) != sizeof(e->aout))
+    if (f->size < sizeof(e->aout))
         loadError("Can't read header: %s\n", path);
+    memcpy(&e->aout, take(f, &pos, sizeof(e->aout), path), sizeof(e->aout));
     if ((e->aout.type & 0xFFFF) != ELKSMAGIC)
         loadError("%s: not ELKS executable\n", path);
-    if (e->aout.hlen != sizeof(e->aout))
-        loadError("Medium model programs not yet supported: %s\n", path);
     if (e->aout.version != 1)
         loadError("Version 0 header programs not yet supported: %s\n", path);
-    if (fstat(fd, &sbuf) < 0)
-        loadError("Can't stat %s\n", path);
-    size_t filesize = sbuf.st_size - e->aout.syms - e->aout.hlen;   /* text+data */
 
-    loadSegment = 0x1000;
-    int loadOffset = loadSegment << 4;
-    if (filesize > RAMSIZE - loadOffset)
-        loadError("Not enough memory to load %s, needs %d bytes have %d\n",
-            path, filesize, RAMSIZE);
-    if (read(fd, &ram[loadOffset], filesize) != filesize)
-        loadError("Error reading executable: %s\n", path);
-    close(fd);
+    /* medium model and relocatable programs have a supplementary header */
+    memset(&e->eshdr, 0, sizeof(e->eshdr));
+    int eslen = e->aout.hlen - sizeof(e->aout);
+    if (eslen < 0 || eslen > sizeof(e->eshdr))
+        loadError("Bad header length %d: %s\n", e->aout.hlen, path);
+    if (eslen > f->size - pos)
+        loadError("Can't read supplementary header: %s\n", path);
+    memcpy(&e->eshdr, take(f, &pos, eslen, path), eslen);
+    bool compressed = e->eshdr.esh_compr_tseg || e->eshdr.esh_compr_ftseg ||
+        e->eshdr.esh_compr_dseg;
 
     unsigned int tseg = e->aout.tseg;
     tseg = (tseg + 15) & ~15;       /* not strictly necessary */
+    unsigned int ftseg = e->eshdr.esh_ftseg;
+    ftseg = (ftseg + 15) & ~15;
+
+    /* text, far text and data each start on a paragraph */
+    loadSegment = 0x1000;
+    e->textseg = loadSegment;
+    e->ftextseg = ftseg? loadSegment + (tseg >> 4): 0;
+    e->dataseg = loadSegment + ((tseg + ftseg) >> 4);
+    char *cache = compressed? cacheName(f): NULL;
+    if (cache && readCache(cache, e)) {
+        if (f_verbose)
+            printf("Using decompressed cache %s\n", cache);
+        take(f, &pos,
+            (e->eshdr.esh_compr_tseg? e->eshdr.esh_compr_tseg: e->aout.tseg) +
+            (e->eshdr.esh_compr_ftseg? e->eshdr.esh_compr_ftseg: e->eshdr.esh_ftseg) +
+            (e->eshdr.esh_compr_dseg? e->eshdr.esh_compr_dseg: e->aout.dseg),
+            path);
+    } else {
+        loadSection(f, &pos, e->textseg, e->aout.tseg, e->eshdr.esh_compr_tseg, path);
+        if (ftseg)
+            loadSection(f, &pos, e->ftextseg, e->eshdr.esh_ftseg,
+                e->eshdr.esh_compr_ftseg, path);
+        loadSection(f, &pos, e->dataseg, e->aout.dseg, e->eshdr.esh_compr_dseg, path);
+        if (cache)
+            writeCache(cache, e);
+    }
+    relocate(f, &pos, e->textseg, e->eshdr.msh_trsize, e, path);
+    relocate(f, &pos, e->ftextseg, e->eshdr.esh_ftrsize, e, path);
+    relocate(f, &pos, e->dataseg, e->eshdr.msh_drsize, e, path);
+
+    /* symbols as sym_read_exe_symbols would read them, but from the mapping */
+    sym_free(e);
+    if (e->aout.syms && e->aout.syms <= f->size - pos &&
+        (e->syms = malloc(e->aout.syms)))
+        memcpy(e->syms, f->map + f->size - e->aout.syms, e->aout.syms);
+    releaseExecutable(f);
+
     unsigned int dseg = e->aout.dseg;
     unsigned int bseg = e->aout.bseg;
     unsigned int stack = e->aout.minstack? e->aout.minstack: 0x1000;
@@ -174,9 +336,9 @@ void loadExecutableElks(struct exe *e, const char *path, int argc, char **argv,
         loadError("Program heap+stack >= 64K: %s\n", path);
 
     setES(loadSegment);
-    setShadowFlags(0, ES, tseg, fRead); /* text read-only */
-    setES(loadSegment + (tseg >> 4));
-    setSS(es());                        /* SS just after text segment */
+    setShadowFlags(0, ES, tseg + ftseg, fRead); /* text read-only */
+    setES(e->dataseg);
+    setSS(es());                        /* SS just after far text segment */
     setDS(ss());                        /* DS = SS */
     //FIXME don't allow stack reads before written
     //FIXME don't allow use of area outside break
@@ -198,7 +360,8 @@ void loadExecutableElks(struct exe *e, const char *path, int argc, char **argv,
 
     write_environ(argc, argv, envp);
     if (f_verbose)
-        printf("Text %04x Data %04x Stack %04x\n", tseg, len-stack, stack);
+        printf("Text %04x Fartext %04x Data %04x Stack %04x\n", tseg, ftseg,
+            len-stack, stack);
 
     //hexdump(sp(), &ram[physicalAddress(sp(), SS, false)], stack-sp(), 0);
     //for (int i=dseg; i<dseg+bseg; i++)  /* clear BSS */
@@ -0,0 +1,188 @@
+/*
+ * 8259A Programmable Interrupt Controller for 8086 emulator
+ *
+ * Master at port 20h and slave at A0h, cascaded on IRQ2 as on the AT.
+ * Fixed priority only, which is all that BIOS, DOS and ELKS program.
+ * Both controllers start with every IRQ masked and the BIOS vector
+ * bases, so guests that never touch the PIC see no interrupts.
+ */
+#include "devices.h"
+#include "portio.h"
+#include "checkpoint.h"
+
+struct pic {
+    uint8_t irr;            /* interrupt request register */
+    uint8_t isr;            /* in service register */
+    uint8_t imr;            /* interrupt mask register */
+    uint8_t lines;          /* IRQ input line levels */
+    uint8_t vector;         /* ICW2 vector base */
+    uint8_t initStep;       /* next ICW expected, 0 when initialized */
+    bool needICW4;
+    bool single;            /* no cascade, ICW3 skipped */
+    bool autoEOI;
+    bool readISR;           /* OCW3 selected ISR for reads */
+};
+
+static struct pic pic[2];
+bool irqPending;
+
+/* highest priority request that isn't masked or blocked by service */
+static int pending(struct pic *p)
+{
+    int irq;
+    uint8_t req = p->irr & ~p->imr;
+
+    for (irq=0; irq<8; irq++) {
+        if (p->isr & (1 << irq))
+            return -1;
+        if (req & (1 << irq))
+            return irq;
+    }
+    return -1;
+}
+
+static void update(void)
+{
+    if (pending(&pic[1]) >= 0)
+        pic[0].irr |= 1 << 2;
+    else if (!(pic[0].lines & (1 << 2)))
+        pic[0].irr &= ~(1 << 2);
+    irqPending = pending(&pic[0]) >= 0;
+}
+
+static void initOne(struct pic *p, uint8_t vector)
+{
+    p->irr = p->isr = p->lines = 0;
+    p->imr = 0xff;
+    p->vector = vector;
+    p->initStep = 0;
+    p->needICW4 = p->single = p->autoEOI = p->readISR = false;
+}
+
+void initPIC(void)
+{
+    initOne(&pic[0], 0x08);
+    initOne(&pic[1], 0x70);
+    update();
+    registerPorts(0x20, 2, picRead, picWrite);
+    registerPorts(0xa0, 2, picRead, picWrite);
+    addState(pic, sizeof(pic));
+    addState(&irqPending, sizeof(irqPending));
+}
+
+/* whether any IRQ could reach the processor, for HLT */
+bool picUnmasked(void)
+{
+    return pic[0].imr != 0xff;
+}
+
+void picRaiseIRQ(int irq)
+{
+    struct pic *p = &pic[irq >> 3];
+    uint8_t bit = 1 << (irq & 7);
+
+    if (!(p->lines & bit))
+        p->irr |= bit;      /* edge triggered */
+    p->lines |= bit;
+    update();
+}
+
+/* the request stays latched in IRR until acknowledged */
+void picLowerIRQ(int irq)
+{
+    struct pic *p = &pic[irq >> 3];
+
+    p->lines &= ~(1 << (irq & 7));
+    update();
+}
+
+static int acknowledge(struct pic *p)
+{
+    int irq = pending(p);
+
+    if (irq < 0)
+        return 7;           /* spurious */
+    p->irr &= ~(1 << irq);
+    if (!p->autoEOI)
+        p->isr |= 1 << irq;
+    return irq;
+}
+
+/* INTA cycle: returns interrupt vector number */
+int picAcknowledge(void)
+{
+    int vector, irq = acknowledge(&pic[0]);
+
+    if (irq == 2 && !pic[0].single)
+        vector = pic[1].vector + acknowledge(&pic[1]);
+    else
+        vector = pic[0].vector + irq;
+    update();
+    return vector;
+}
+
+static void endOfInterrupt(struct pic *p, int irq)
+{
+    if (irq < 0) {
+        for (irq=0; irq<8; irq++) {
+            if (p->isr & (1 << irq))
+                break;
+        }
+    }
+    p->isr &= ~(1 << (irq & 7));
+}
+
+uint8_t picRead(uint16_t port)
+{
+    struct pic *p = &pic[(port & 0x80) != 0];
+
+    if (port & 1)
+        return p->imr;
+    return p->readISR ? p->isr : p->irr;
+}
+
+void picWrite(uint16_t port, uint8_t value)
+{
+    struct pic *p = &pic[(port & 0x80) != 0];
+
+    if (!(port & 1)) {
+        if (value & 0x10) {                 /* ICW1 */
+            p->isr = p->irr = 0;
+            p->imr = 0;
+            p->needICW4 = value & 0x01;
+            p->single = value & 0x02;
+            p->autoEOI = p->readISR = false;
+            p->initStep = 2;
+        } else if (value & 0x08) {          /* OCW3 */
+            if (value & 0x02)
+                p->readISR = value & 0x01;
+        } else {                            /* OCW2 */
+            switch (value >> 5) {
+            case 1: case 5:                 /* non-specific EOI */
+                endOfInterrupt(p, -1);
+                break;
+            case 3: case 7:                 /* specific EOI */
+                endOfInterrupt(p, value & 7);
+                break;
+            }
+        }
+    } else {
+        switch (p->initStep) {
+        case 2:                             /* ICW2 */
+            p->vector = value & 0xf8;
+            p->initStep = !p->single ? 3 : p->needICW4 ? 4 : 0;
+            break;
+        case 3:                             /* ICW3 */
+            p->initStep = p->needICW4 ? 4 : 0;
+            break;
+        case 4:                             /* ICW4 */
+            p->autoEOI = value & 0x02;
+            p->initStep = 0;
+            break;
+        default:                            /* OCW1 */
+            p->imr = value;
+            break;
+        }
+    }
+    update();
+}
@@ -0,0 +1,185 @@
+/*
+ * 8253 Programmable Interval Timer for 8086 emulator
+ *
+ * Counters are not stepped, their value is computed from the processor
+ * clock when read. Counter 0 posts a scheduler event at each output
+ * rising edge, which pulses IRQ0. Gates are always enabled, so the
+ * hardware triggered modes 1 and 5 never start counting.
+ */
+#include "devices.h"
+#include "sched.h"
+#include "portio.h"
+#include "checkpoint.h"
+
+struct counter {
+    uint8_t mode;           /* 0-5 */
+    uint8_t access;         /* 1 LSB, 2 MSB, 3 LSB then MSB */
+    uint16_t reload;        /* count register, 0 is 65536 */
+    uint16_t latch;
+    bool latched;
+    bool readMSB;           /* next read returns MSB */
+    bool writeMSB;          /* next write loads MSB */
+    bool counting;
+    Clock start;            /* cpuClock at count load */
+};
+
+static struct counter counter[3];
+
+static uint32_t divisor(struct counter *c)
+{
+    return c->reload ? c->reload : 0x10000;
+}
+
+static uint16_t currentCount(struct counter *c)
+{
+    uint32_t n = divisor(c);
+    Clock ticks;
+
+    if (!c->counting)
+        return c->reload;
+    ticks = (cpuClock - c->start) / PIT_DIVISOR;
+    switch (c->mode) {
+    case 2:                 /* rate generator */
+        return n - ticks % n;
+    case 3:                 /* square wave counts down by 2 each half */
+        if (n < 2)
+            return n;
+        return n - 2 * (ticks % (n / 2));
+    default:                /* one shot, wraps after terminal count */
+        return n - ticks;
+    }
+}
+
+static void counter0Event(Clock when)
+{
+    struct counter *c = &counter[0];
+
+    picRaiseIRQ(0);
+    picLowerIRQ(0);
+    if (c->mode == 2 || c->mode == 3)
+        scheduleEvent(EV_PIT0, when + (Clock)divisor(c) * PIT_DIVISOR,
+            counter0Event);
+}
+
+static void load(int n)
+{
+    struct counter *c = &counter[n];
+
+    c->counting = c->mode != 1 && c->mode != 5;
+    c->start = cpuClock;
+    if (n != 0)
+        return;
+    if (!c->counting)
+        cancelEvent(EV_PIT0);
+    else if (c->mode == 0 || c->mode == 4)   /* output at terminal count */
+        scheduleEvent(EV_PIT0, cpuClock + (Clock)(divisor(c) + 1) * PIT_DIVISOR,
+            counter0Event);
+    else
+        scheduleEvent(EV_PIT0, cpuClock + (Clock)divisor(c) * PIT_DIVISOR,
+            counter0Event);
+}
+
+static void setMode(int n, uint8_t mode, uint8_t access, uint16_t reload)
+{
+    struct counter *c = &counter[n];
+
+    c->mode = mode;
+    c->access = access;
+    c->reload = reload;
+    c->latched = c->readMSB = c->writeMSB = false;
+    c->counting = false;
+    if (n == 0)
+        cancelEvent(EV_PIT0);
+}
+
+/* counters as left by the PC BIOS */
+void initPIT(void)
+{
+    setMode(0, 3, 3, 0);        /* 18.2 Hz system timer */
+    load(0);
+    setMode(1, 2, 1, 18);       /* DRAM refresh */
+    load(1);
+    setMode(2, 3, 3, 1331);     /* 896 Hz speaker tone */
+    registerPorts(0x40, 4, pitRead, pitWrite);
+    addState(counter, sizeof(counter));
+}
+
+uint8_t pitRead(uint16_t port)
+{
+    struct counter *c;
+    uint16_t count;
+    uint8_t value;
+
+    if ((port & 3) == 3)
+        return 0xff;
+    c = &counter[port & 3];
+    count = c->latched ? c->latch : currentCount(c);
+    switch (c->access) {
+    case 1:
+        value = count;
+        c->latched = false;
+        break;
+    case 2:
+        value = count >> 8;
+        c->latched = false;
+        break;
+    default:
+        value = c->readMSB ? count >> 8 : count;
+        if (c->readMSB)
+            c->latched = false;
+        c->readMSB = !c->readMSB;
+        break;
+    }
+    return value;
+}
+
+void pitWrite(uint16_t port, uint8_t value)
+{
+    struct counter *c;
+    int n, mode;
+
+    if ((port & 3) == 3) {                  /* control word */
+        n = value >> 6;
+        if (n == 3)                         /* 8254 read back */
+            return;
+        c = &counter[n];
+        if ((value & 0x30) == 0) {          /* counter latch */
+            if (!c->latched) {
+                c->latch = currentCount(c);
+                c->latched = true;
+                c->readMSB = false;
+            }
+            return;
+        }
+        mode = (value >> 1) & 7;
+        if (mode > 5)
+            mode -= 4;
+        setMode(n, mode, (value >> 4) & 3, c->reload);
+        return;
+    }
+    n = port & 3;
+    c = &counter[n];
+    switch (c->access) {
+    case 1:
+        c->reload = value;
+        load(n);
+        break;
+    case 2:
+        c->reload = value << 8;
+        load(n);
+        break;
+    default:
+        if (!c->writeMSB) {
+            c->reload = (c->reload & 0xff00) | value;
+            if (c->mode == 0 && n == 0) {   /* LSB write stops mode 0 */
+                c->counting = false;
+                cancelEvent(EV_PIT0);
+            }
+        } else {
+            c->reload = (c->reload & 0x00ff) | (value << 8);
+            load(n);
+        }
+        c->writeMSB = !c->writeMSB;
+        break;
+    }
+}
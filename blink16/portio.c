@@ -0,0 +1,69 @@
+/*
+ * I/O port dispatch for 8086 emulator devices
+ *
+ * Each device registers read/write callbacks for its port range at
+ * init time. A 64K byte table maps every port to a handler slot, so
+ * an IN or OUT costs two indexed loads and an indirect call. Slot 0
+ * is the open bus: reads return FFh and writes are ignored.
+ */
+#include <stdio.h>
+#include "portio.h"
+
+#define MAXHANDLERS 32
+
+struct handler {
+    PortReadFn read;
+    PortWriteFn write;
+};
+
+static uint8_t openBusRead(uint16_t port)
+{
+    return 0xff;
+}
+
+static void openBusWrite(uint16_t port, uint8_t value)
+{
+}
+
+static struct handler handlers[MAXHANDLERS];
+static int numHandlers;
+static uint8_t portHandler[0x10000];
+
+void initPorts(void)
+{
+    int i;
+
+    for (i=0; i<0x10000; i++)
+        portHandler[i] = 0;
+    handlers[0].read = openBusRead;
+    handlers[0].write = openBusWrite;
+    numHandlers = 1;
+}
+
+/* later registrations override earlier ones on overlapping ports */
+void registerPorts(uint16_t base, int count, PortReadFn read, PortWriteFn write)
+{
+    int i;
+    struct handler *h;
+
+    if (numHandlers >= MAXHANDLERS) {
+        fprintf(stderr, "Too many I/O port handlers at %04x\n", base);
+        return;
+    }
+    h = &handlers[numHandlers];
+    h->read = read ? read : openBusRead;
+    h->write = write ? write : openBusWrite;
+    for (i=0; i<count && base + i < 0x10000; i++)
+        portHandler[base + i] = numHandlers;
+    numHandlers++;
+}
+
+uint8_t inPortByte(uint16_t port)
+{
+    return handlers[portHandler[port]].read(port);
+}
+
+void outPortByte(uint16_t port, uint8_t value)
+{
+    handlers[portHandler[port]].write(port, value);
+}
@@ -0,0 +1,15 @@
+#ifndef PORTIO_H_
+#define PORTIO_H_
+/* I/O port dispatch for 8086 emulator devices */
+
+#include <stdint.h>
+
+typedef uint8_t (*PortReadFn)(uint16_t port);
+typedef void (*PortWriteFn)(uint16_t port, uint8_t value);
+
+void initPorts(void);
+void registerPorts(uint16_t base, int count, PortReadFn read, PortWriteFn write);
+uint8_t inPortByte(uint16_t port);
+void outPortByte(uint16_t port, uint8_t value);
+
+#endif
@@ -0,0 +1,259 @@
+/*
+ * Record and replay of nondeterministic inputs for 8086 emulator
+ *
+ * Guest execution is deterministic given the processor clock, except
+ * where the emulator consults the host: keyboard and serial input,
+ * disk reads, and the host calls behind ELKS and DOS system calls.
+ * Each of those passes its result and any bytes it stores into guest
+ * memory through here. Recording appends them to a gzip compressed
+ * log, each stamped with cpuClock. Replaying returns the logged values
+ * instead, so the run re-executes identically without a human at the
+ * keyboard, and a stamp that doesn't match the clock reports where the
+ * replay diverged. When the log runs out execution continues live.
+ *
+ * The same records can also be kept in an in-memory journal, which
+ * lets reverse execution rewind to a checkpoint and re-execute forward
+ * from any journal position, going live again past its end.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <zlib.h>
+#include "8086.h"
+#include "sched.h"
+#include "replay.h"
+
+#define MAGIC       "B16R"
+#define VERSION     2
+
+enum { REC_RESULT = 1, REC_MEMORY, REC_PRESENT };
+
+struct record {
+    uint8_t kind;
+    uint64_t stamp;             /* cpuClock when input was taken */
+    uint32_t len;               /* memory bytes following, or errno */
+    int64_t value;
+};
+
+bool recording;
+bool replaying;
+bool reexecuting;
+
+static gzFile replayLog;
+static struct record next;      /* lookahead when replaying */
+static bool haveNext;
+
+static bool journaling;
+static char *journal;           /* records kept for re-execution */
+static long journalLen;
+static long journalMax;
+static long journalBase;        /* position of journal[0] */
+static long journalRead;        /* offset of next input when re-executing */
+static long nextPos;            /* offset of lookahead record */
+
+static void appendJournal(const void *buf, long len)
+{
+    if (journalLen + len > journalMax) {
+        journalMax = (journalLen + len) * 2;
+        journal = realloc(journal, journalMax);
+        if (!journal)
+            runtimeError("Out of memory for input journal\n");
+    }
+    memcpy(journal + journalLen, buf, len);
+    journalLen += len;
+}
+
+static void readJournal(void *buf, long len)
+{
+    if (journalRead + len > journalLen)
+        runtimeError("Input journal truncated\n");
+    memcpy(buf, journal + journalRead, len);
+    journalRead += len;
+}
+
+static void readNext(void)
+{
+    if (reexecuting) {
+        nextPos = journalRead;
+        if (journalRead < journalLen)
+            readJournal(&next, sizeof(next));
+        else
+            reexecuting = replaying = false;    /* caught up, live again */
+        return;
+    }
+    haveNext = gzread(replayLog, &next, sizeof(next)) == sizeof(next);
+    if (!haveNext) {
+        fprintf(stderr, "replay: end of recording at clock %llu\n",
+            (unsigned long long)cpuClock);
+        gzclose(replayLog);
+        replaying = false;
+    }
+}
+
+int startRecording(const char *path)
+{
+    int version = VERSION;
+
+    if (!(replayLog = gzopen(path, "wb")))
+        return -1;
+    gzwrite(replayLog, MAGIC, 4);
+    gzwrite(replayLog, &version, sizeof(version));
+    recording = true;
+    atexit(stopRecording);
+    return 0;
+}
+
+int startReplay(const char *path)
+{
+    char magic[4];
+    int version;
+
+    if (!(replayLog = gzopen(path, "rb")))
+        return -1;
+    if (gzread(replayLog, magic, 4) != 4 || memcmp(magic, MAGIC, 4) ||
+        gzread(replayLog, &version, sizeof(version)) != sizeof(version) ||
+        version != VERSION) {
+        gzclose(replayLog);
+        errno = EINVAL;
+        return -1;
+    }
+    replaying = true;
+    readNext();
+    return 0;
+}
+
+void stopRecording(void)
+{
+    if (recording) {
+        gzclose(replayLog);
+        recording = false;
+    }
+}
+
+/* keep inputs in memory from now on, discarding any kept */
+void startJournal(void)
+{
+    journaling = true;
+    journalBase += journalLen;
+    journalLen = 0;
+    if (reexecuting)
+        reexecuting = replaying = false;
+}
+
+/* position of the next input, to rewind to later */
+long journalPosition(void)
+{
+    return journalBase + (reexecuting ? nextPos : journalLen);
+}
+
+/* re-execute the inputs from a position until the journal runs out */
+void rewindJournal(long pos)
+{
+    journalRead = pos - journalBase;
+    reexecuting = replaying = journalRead < journalLen;
+    if (reexecuting)
+        readNext();
+}
+
+/* discard inputs before a position no longer rewound to */
+void trimJournal(long pos)
+{
+    long n = pos - journalBase;
+
+    memmove(journal, journal + n, journalLen - n);
+    journalLen -= n;
+    journalRead -= n;
+    nextPos -= n;
+    journalBase = pos;
+}
+
+long journalSize(void)
+{
+    return journalLen;
+}
+
+static void writeRecord(int kind, uint32_t len, int64_t value, const void *buf)
+{
+    struct record r;
+
+    memset(&r, 0, sizeof(r));
+    r.kind = kind;
+    r.stamp = cpuClock;
+    r.len = len;
+    r.value = value;
+    if (recording) {
+        gzwrite(replayLog, &r, sizeof(r));
+        if (buf)
+            gzwrite(replayLog, buf, len);
+    }
+    if (journaling) {
+        appendJournal(&r, sizeof(r));
+        if (buf)
+            appendJournal(buf, len);
+    }
+}
+
+/* take the next record, which must be of kind and stamped now */
+static struct record *takeRecord(int kind)
+{
+    static struct record r;
+
+    if (next.kind != kind || next.stamp != cpuClock)
+        runtimeError("Replay diverged at clock %llu, recorded input at %llu\n",
+            (unsigned long long)cpuClock, (unsigned long long)next.stamp);
+    r = next;
+    return &r;
+}
+
+/* log a host result with errno, or return the logged one */
+long replayResult(long result)
+{
+    struct record *r;
+    int err = errno;
+
+    if (replaying) {
+        r = takeRecord(REC_RESULT);
+        readNext();
+        errno = r->len;
+        return r->value;
+    }
+    writeRecord(REC_RESULT, err, result, 0);
+    errno = err;
+    return result;
+}
+
+/* log bytes a host call stored in guest memory, or store the logged ones */
+void replayMemory(void *buf, long len)
+{
+    struct record *r;
+
+    if (len <= 0)
+        return;
+    if (replaying) {
+        r = takeRecord(REC_MEMORY);
+        if (r->len != len)
+            runtimeError("Replay diverged at clock %llu, %ld bytes recorded as %u\n",
+                (unsigned long long)cpuClock, len, r->len);
+        if (reexecuting)
+            readJournal(buf, len);
+        else if (gzread(replayLog, buf, len) != len)
+            runtimeError("Replay log truncated\n");
+        readNext();
+    } else
+        writeRecord(REC_MEMORY, len, 0, buf);
+}
+
+/* log an input only when present, or return whether one was logged now */
+bool replayPresent(bool present)
+{
+    if (replaying) {
+        if (next.kind != REC_PRESENT || next.stamp != cpuClock)
+            return false;
+        readNext();
+        return true;
+    }
+    if (present)
+        writeRecord(REC_PRESENT, 0, 0, 0);
+    return present;
+}
@@ -0,0 +1,27 @@
+#ifndef REPLAY_H_
+#define REPLAY_H_
+/* record and replay of nondeterministic inputs for 8086 emulator */
+
+#include <stdbool.h>
+
+extern bool recording;
+extern bool replaying;
+extern bool reexecuting;        /* replaying from the journal after a rewind */
+
+int startRecording(const char *path);
+int startReplay(const char *path);
+void stopRecording(void);
+long replayResult(long result);
+void replayMemory(void *buf, long len);
+bool replayPresent(bool present);
+
+void startJournal(void);
+long journalPosition(void);
+void rewindJournal(long pos);
+void trimJournal(long pos);
+long journalSize(void);
+
+/* result of a host call, which isn't made when replaying */
+#define HOSTCALL(call)  replayResult(replaying ? 0 : (long)(call))
+
+#endif
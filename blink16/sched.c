@@ -0,0 +1,136 @@
+/*
+ * Cycle-keyed event scheduler for 8086 emulator
+ *
+ * Device timers post events at an absolute processor clock. The
+ * instruction loop compares cpuClock against nextEvent once per
+ * instruction, so nothing is paid until an event is actually due.
+ * HLT skips the clock forward to the next event instead of spinning,
+ * and sleeps the host while the guest is ahead of real time.
+ */
+#include <time.h>
+#include "sched.h"
+#include "replay.h"
+#include "checkpoint.h"
+#include "counters.h"
+
+#define NEVER       UINT64_MAX
+#define NSEC        1000000000LL
+
+Clock cpuClock;
+Clock nextEvent = NEVER;
+
+static struct event {
+    Clock when;
+    void (*fn)(Clock when);
+} events[EV_MAX];
+
+static Clock guestAnchor;           /* pacing reference points */
+static long long hostAnchor;
+
+static long long hostNanoseconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC + ts.tv_nsec;
+}
+
+static long long clocksToNanoseconds(Clock c)
+{
+    return (c / CPU_HZ) * NSEC + (c % CPU_HZ) * NSEC / CPU_HZ;
+}
+
+static void updateNextEvent(void)
+{
+    int i;
+
+    nextEvent = NEVER;
+    for (i=0; i<EV_MAX; i++) {
+        if (events[i].fn && events[i].when < nextEvent)
+            nextEvent = events[i].when;
+    }
+}
+
+void initScheduler(void)
+{
+    int i;
+
+    cpuClock = 0;
+    for (i=0; i<EV_MAX; i++)
+        events[i].fn = 0;
+    nextEvent = NEVER;
+    guestAnchor = 0;
+    hostAnchor = hostNanoseconds();
+    addState(&cpuClock, sizeof(cpuClock));
+    addState(&nextEvent, sizeof(nextEvent));
+    addState(events, sizeof(events));
+}
+
+void scheduleEvent(int ev, Clock when, void (*fn)(Clock when))
+{
+    events[ev].when = when;
+    events[ev].fn = fn;
+    updateNextEvent();
+}
+
+void cancelEvent(int ev)
+{
+    events[ev].fn = 0;
+    updateNextEvent();
+}
+
+/* run all events due by cpuClock, handlers may reschedule themselves */
+void runEvents(void)
+{
+    int i;
+    Clock when;
+    void (*fn)(Clock when);
+
+    while (nextEvent <= cpuClock) {
+        for (i=0; i<EV_MAX; i++) {
+            if (events[i].fn && events[i].when <= cpuClock) {
+                fn = events[i].fn;
+                when = events[i].when;
+                events[i].fn = 0;
+                fn(when);
+            }
+        }
+        updateNextEvent();
+    }
+}
+
+/*
+ * Halted processor: jump the clock to the next event and run it.
+ * The guest clock races ahead of real time while executing, so
+ * pacing is reset whenever the skipped interval alone doesn't
+ * account for the lead, and the host only sleeps for idle time.
+ * Returns false if nothing is scheduled that could wake the guest.
+ */
+bool idleUntilEvent(void)
+{
+    Clock skip;
+    long long now, ahead;
+    struct timespec ts;
+    struct timer t;
+
+    if (nextEvent == NEVER)
+        return false;
+    skip = nextEvent > cpuClock ? nextEvent - cpuClock : 0;
+    cpuClock += skip;
+    now = hostNanoseconds();
+    ahead = clocksToNanoseconds(cpuClock - guestAnchor) - (now - hostAnchor);
+    if (ahead > clocksToNanoseconds(skip) || ahead < -NSEC) {
+        guestAnchor = cpuClock - skip;
+        hostAnchor = now;
+        ahead = clocksToNanoseconds(skip);
+    }
+    if (ahead > 0 && !reexecuting) {
+        ts.tv_sec = ahead / NSEC;
+        ts.tv_nsec = ahead % NSEC;
+        t = enterTimer(TIME_IDLE);
+        nanosleep(&ts, 0);
+        leaveTimer(t);
+    }
+    runEvents();
+    return true;
+}
@@ -0,0 +1,25 @@
+#ifndef SCHED_H_
+#define SCHED_H_
+/* cycle-keyed event scheduler for 8086 emulator */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CPU_HZ          4772727     /* 4.77 MHz PC/XT processor clock */
+#define INSN_CLOCKS     8           /* nominal clocks per instruction */
+
+typedef uint64_t Clock;
+
+/* event slots, one per device timer */
+enum { EV_PIT0 = 0, EV_UART, EV_MAX };
+
+extern Clock cpuClock;              /* processor clocks since reset */
+extern Clock nextEvent;             /* clock of soonest pending event */
+
+void initScheduler(void);
+void scheduleEvent(int ev, Clock when, void (*fn)(Clock when));
+void cancelEvent(int ev);
+void runEvents(void);
+bool idleUntilEvent(void);
+
+#endif
@@ -0,0 +1,282 @@
+/*
+ * System call tracing for 8086 emulator
+ *
+ * With --trace-syscalls, each ELKS system call and DOS INT 21h function
+ * the emulator handles is written out like strace does, one line each:
+ *
+ *  1234567 write(1, "hello\n", 6) = 6 <0.000012>
+ *
+ * that is the processor clock at the call, the call decoded from its
+ * registers with strings and buffers shown from guest memory, the result,
+ * and the host time spent in the handler. Registers are saved on entry
+ * and the line written on return, so a buffer read into is shown as read.
+ * A call that doesn't return, such as exit or one that fails with a
+ * runtime error, is written at exit with a result of ?. Output is to a
+ * file or an inherited descriptor, fully buffered, so tracing costs a
+ * formatted line per call and nothing per instruction.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "8086.h"
+#include "sched.h"
+#include "strace.h"
+
+#define MAXSHOW     32          /* string and buffer bytes shown */
+
+/*
+ * Arguments are pairs of a kind and a register. Kinds:
+ *  d decimal  x hex  s string at seg:reg  $ $-terminated string at seg:reg
+ *  w buffer at seg:reg, shown on entry, its length the next argument
+ *  r buffer at seg:reg, shown on return, its length the result
+ *  e string at ES:reg  L 32-bit reg:DX
+ * Registers: a b c d ax..dx, S si, D di, E es, A al, l dl.
+ * Results: d decimal, x hex, D hex DX, l 32-bit DX:AX, - none, n none.
+ * DOS calls fail with CF set, other than those with x or n results,
+ * which leave CF as the caller had it.
+ */
+struct call {
+    const char *name;
+    const char *args;
+    char result;
+};
+
+static const struct call elksCalls[256] = {
+    [1]  = { "exit",   "db",       'd' },
+    [3]  = { "read",   "dbrcdd",   'd' },
+    [4]  = { "write",  "dbwcdd",   'd' },
+    [5]  = { "open",   "sbxcxd",   'd' },
+    [6]  = { "close",  "db",       'd' },
+    [17] = { "brk",    "xb",       'd' },
+    [54] = { "ioctl",  "dbxcxd",   'd' },
+    [69] = { "sbrk",   "dbxc",     'd' },
+};
+
+static const struct call dosCalls[256] = {
+    [0x09] = { "print",    "$d",       'n' },
+    [0x30] = { "version",  "",         'x' },
+    [0x39] = { "mkdir",    "sd",       '-' },
+    [0x3a] = { "rmdir",    "sd",       '-' },
+    [0x3b] = { "chdir",    "sd",       '-' },
+    [0x3c] = { "creat",    "sdxc",     'd' },
+    [0x3d] = { "open",     "sdxA",     'd' },
+    [0x3e] = { "close",    "db",       '-' },
+    [0x3f] = { "read",     "dbrddc",   'd' },
+    [0x40] = { "write",    "dbwddc",   'd' },
+    [0x41] = { "unlink",   "sd",       '-' },
+    [0x42] = { "lseek",    "dbLcdA",   'l' },
+    [0x44] = { "ioctl",    "dbxA",     'D' },
+    [0x47] = { "getcwd",   "dlsS",     '-' },
+    [0x4a] = { "resize",   "xExb",     '-' },
+    [0x4c] = { "exit",     "dA",       '-' },
+    [0x56] = { "rename",   "sdeD",     '-' },
+    [0x57] = { "filetime", "dAdb",     '-' },
+};
+
+bool tracingSyscalls;
+
+static FILE *out;
+static bool pending;            /* entered, not yet returned */
+static bool elks;
+static Word saved[12];          /* regs.w[] on entry */
+static Word savedFlags;
+static Clock entryClock;
+static struct timespec start;
+
+static void flushPending(void);
+
+/* trace to path, or an open descriptor if a number */
+int startSyscallTrace(const char *path)
+{
+    static char buf[65536];
+    char *end;
+    long fd = strtol(path, &end, 10);
+
+    if (*path && !*end)
+        out = fdopen(fd, "w");
+    else
+        out = fopen(path, "w");
+    if (!out)
+        return -1;
+    setvbuf(out, buf, _IOFBF, sizeof(buf));
+    tracingSyscalls = true;
+    atexit(flushPending);
+    return 0;
+}
+
+static Word reg(int r)
+{
+    switch (r) {
+    case 'a': return saved[0];
+    case 'c': return saved[1];
+    case 'd': return saved[2];
+    case 'b': return saved[3];
+    case 'S': return saved[6];
+    case 'D': return saved[7];
+    case 'E': return saved[8];
+    case 'A': return saved[0] & 0xff;
+    case 'l': return saved[2] & 0xff;
+    }
+    return 0;
+}
+
+static Byte peek(Word seg, Word off)
+{
+    return ram[wrapA20(((DWord)seg << 4) + off)];
+}
+
+/* show n bytes at seg:off, or up to a terminator if n is negative */
+static void showBytes(Word seg, Word off, int n, int term)
+{
+    int i, c;
+
+    fputc('"', out);
+    for (i=0; i<MAXSHOW && (n < 0 || i < n); i++) {
+        c = peek(seg, off + i);
+        if (n < 0 && c == term)
+            break;
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c == '\n')
+            fputs("\\n", out);
+        else if (c == '\r')
+            fputs("\\r", out);
+        else if (c == '\t')
+            fputs("\\t", out);
+        else if (isprint(c))
+            fputc(c, out);
+        else
+            fprintf(out, "\\x%02x", c);
+    }
+    fputc('"', out);
+    if (i == MAXSHOW && (n < 0 ? peek(seg, off + i) != term : i < n))
+        fputs("...", out);
+}
+
+/* whether a DOS call failed, CF set by it rather than left set */
+static bool failed(const struct call *c)
+{
+    if (elks || !(getFlags() & 1))
+        return false;
+    if (c->name && c->result != 'x' && c->result != 'n')
+        return true;
+    return !(savedFlags & 1);
+}
+
+static void showCall(const struct call *c, int number, bool done)
+{
+    const char *a;
+    Word data = elks ? saved[10] : saved[11];   /* ELKS pointers are SS */
+    long result = elks ? (short)regs.w[0] : regs.w[0];
+    int n;
+
+    fprintf(out, "%llu ", (unsigned long long)entryClock);
+    if (!c->name) {
+        if (elks)
+            fprintf(out, "syscall_%d(0x%x, 0x%x, 0x%x)", number,
+                saved[3], saved[1], saved[2]);
+        else
+            fprintf(out, "int21_%02x(ax=0x%04x, bx=0x%04x, cx=0x%04x, dx=0x%04x)",
+                number, saved[0], saved[3], saved[1], saved[2]);
+    } else {
+        fprintf(out, "%s(", c->name);
+        for (a=c->args; *a; a+=2) {
+            if (a != c->args)
+                fputs(", ", out);
+            switch (a[0]) {
+            case 'd':
+                fprintf(out, "%d", reg(a[1]));
+                break;
+            case 'x':
+                fprintf(out, "0x%x", reg(a[1]));
+                break;
+            case 's':
+                showBytes(data, reg(a[1]), -1, 0);
+                break;
+            case '$':
+                showBytes(data, reg(a[1]), -1, '$');
+                break;
+            case 'e':
+                showBytes(saved[8], reg(a[1]), -1, 0);
+                break;
+            case 'w':
+                showBytes(data, reg(a[1]), reg(a[3]), 0);
+                break;
+            case 'r':
+                n = done && !failed(c) ? result : 0;
+                if (n > 0)
+                    showBytes(data, reg(a[1]), n, 0);
+                else
+                    fprintf(out, "0x%x", reg(a[1]));
+                break;
+            case 'L':
+                fprintf(out, "%ld", (long)((DWord)reg(a[1]) << 16 | saved[2]));
+                break;
+            }
+        }
+        fputc(')', out);
+    }
+    if (!done) {
+        fputs(" = ?\n", out);
+        return;
+    }
+    if (failed(c))
+        fprintf(out, " = error %ld", result);
+    else if (elks || c->result == 'd')
+        fprintf(out, " = %ld", result);
+    else if (c->result == 'x')
+        fprintf(out, " = 0x%lx", result);
+    else if (c->result == 'D')
+        fprintf(out, " = 0x%x", regs.w[2]);
+    else if (c->result == 'l')
+        fprintf(out, " = %lu", (unsigned long)((DWord)regs.w[2] << 16 | regs.w[0]));
+    else
+        fputs(" = 0", out);
+}
+
+void traceSyscallEntry(int intno)
+{
+    memcpy(saved, regs.w, sizeof(saved));
+    savedFlags = getFlags();
+    elks = intno == 0x80;
+    entryClock = cpuClock;
+    pending = true;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+}
+
+static int callNumber(void)
+{
+    return elks ? saved[0] : saved[0] >> 8;
+}
+
+static const struct call *lookup(void)
+{
+    static const struct call unknown;
+
+    if (!elks)
+        return &dosCalls[callNumber()];
+    return callNumber() < 256 ? &elksCalls[callNumber()] : &unknown;
+}
+
+void traceSyscallExit(void)
+{
+    struct timespec end;
+    long ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns = (end.tv_sec - start.tv_sec) * 1000000000L + end.tv_nsec - start.tv_nsec;
+    pending = false;
+    showCall(lookup(), callNumber(), true);
+    fprintf(out, " <%ld.%06ld>\n", ns / 1000000000L, ns / 1000 % 1000000);
+}
+
+static void flushPending(void)
+{
+    if (pending) {
+        pending = false;
+        showCall(lookup(), callNumber(), false);
+    }
+    fflush(out);
+}
@@ -0,0 +1,13 @@
+#ifndef STRACE_H_
+#define STRACE_H_
+/* system call tracing for 8086 emulator */
+
+#include <stdbool.h>
+
+extern bool tracingSyscalls;
+
+int startSyscallTrace(const char *path);
+void traceSyscallEntry(int intno);
+void traceSyscallExit(void);
+
+#endif
@@ -112,18 +112,29 @@ static int noinstrument type_data(unsigned char *p)
 }
 
 // FIXME rewrite as iterator function
-unsigned char * noinstrument sym_next_text_entry(struct exe *e, unsigned char *entry)
+static unsigned char * noinstrument next_entry(struct exe *e, unsigned char *entry,
+    int (*istype)(unsigned char *p))
 {
     unsigned char *p = entry? symNext(entry): e->syms;
-    for ( ; p; p = symNext(p)) {
-        if (type_text(p))
+    for ( ; p && p[TYPE]; p = symNext(p)) {
+        if (istype(p))
             return p;
-        if (entry)      /* done after last text entry */
+        if (entry)      /* done after last entry of type */
             break;
      }
      return 0;
 }
 
+unsigned char * noinstrument sym_next_text_entry(struct exe *e, unsigned char *entry)
+{
+    return next_entry(e, entry, type_text);
+}
+
+unsigned char * noinstrument sym_next_ftext_entry(struct exe *e, unsigned char *entry)
+{
+    return next_entry(e, entry, type_ftext);
+}
+
 /* return symbol address */
 addr_t noinstrument sym_address(struct exe *e, const char *name)
 {
@@ -142,21 +153,39 @@ addr_t noinstrument sym_address(struct exe *e, const char *name)
     return symAddr(lastp);
 }
 
-/* map .text address to function start address */
-addr_t  noinstrument sym_fn_start_address(struct exe *e, addr_t addr)
+/* map address to function start address */
+static addr_t noinstrument fn_start_address(struct exe *e, addr_t addr,
+    int (*istype)(unsigned char *p))
 {
     unsigned char *p, *lastp;
 
     if (!e->syms) return -1;
 
     lastp = e->syms;
+    while (!istype(lastp)) {
+        lastp = symNext(lastp);
+        if (!lastp[TYPE])
+            return -1;
+    }
     for (p = symNext(lastp); ; lastp = p, p = symNext(p)) {
-        if (!type_text(p) || ((unsigned short)addr < symAddr(p)))
+        if (!istype(p) || ((unsigned short)addr < symAddr(p)))
             break;
     }
     return symAddr(lastp);
 }
 
+/* map .text address to function start address */
+addr_t  noinstrument sym_fn_start_address(struct exe *e, addr_t addr)
+{
+    return fn_start_address(e, addr, type_text);
+}
+
+/* map .fartext address to function start address */
+addr_t  noinstrument sym_ftext_fn_start_address(struct exe *e, addr_t addr)
+{
+    return fn_start_address(e, addr, type_ftext);
+}
+
 /* convert address to symbol string */
 static char * noinstrument sym_string(struct exe *e, addr_t addr, int exact,
     int (*istype)(unsigned char *p))
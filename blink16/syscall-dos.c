@@ -9,6 +9,8 @@
 #include <sys/stat.h>
 #include "8086.h"
 #include "exe.h"
+#include "replay.h"
+#include "counters.h"
 
 #if BLINK16
 #include "blink/machine.h"
@@ -51,8 +53,10 @@ static char* initString(Word offset, int seg, int write, int buffer, int bytes)
     for (int i = 0; i < bytes; ++i) {
         char p;
         if (write) {
+            DWord a = physicalAddress(offset + i, seg, true);
             p = pathBuffers[buffer][i];
-            ram[physicalAddress(offset + i, seg, true)] = p;
+            ram[a] = p;
+            setDirty(a, 1);
         }
         else {
             p = ram[physicalAddress(offset + i, seg, false)];
@@ -117,9 +121,9 @@ static int SysWrite(struct exe *e, int fd, char *buf, size_t n)
 #if BLINK16
     extern ssize_t ptyWrite(int fd, char *buf, int len);
     SetWriteAddr(g_machine, physicalAddress(dx(), DS, false), n);
-    return ptyWrite(fd, buf, n);
+    return replayResult(reexecuting || (replaying && fd > 2) ? 0 : ptyWrite(fd, buf, n));
 #else
-    return write(fd, buf, n);
+    return replayResult(reexecuting || (replaying && fd > 2) ? 0 : write(fd, buf, n));
 #endif
 }
 
@@ -134,6 +138,7 @@ bool handleSyscallDOS(struct exe *e, int intno)
             init();
             once = 1;
         }
+                counters.dosCalls[ah()]++;
                 switch (intno << 8 | ah()) {
                     case 0x1a00:
                         data = es();
@@ -154,7 +159,7 @@ bool handleSyscallDOS(struct exe *e, int intno)
                         setCX(0);
                         break;
                     case 0x2139:
-                        if (mkdir(dsdx(), 0700) == 0)
+                        if (HOSTCALL(mkdir(dsdx(), 0700)) == 0)
                             setCF(false);
                         else {
                             setCF(true);
@@ -162,7 +167,7 @@ bool handleSyscallDOS(struct exe *e, int intno)
                         }
                         break;
                     case 0x213a:
-                        if (rmdir(dsdx()) == 0)
+                        if (HOSTCALL(rmdir(dsdx())) == 0)
                             setCF(false);
                         else {
                             setCF(true);
@@ -170,7 +175,7 @@ bool handleSyscallDOS(struct exe *e, int intno)
                         }
                         break;
                     case 0x213b:
-                        if (chdir(dsdx()) == 0)
+                        if (HOSTCALL(chdir(dsdx())) == 0)
                             setCF(false);
                         else {
                             setCF(true);
@@ -178,7 +183,7 @@ bool handleSyscallDOS(struct exe *e, int intno)
                         }
                         break;
                     case 0x213c:
-                        fileDescriptor = creat(dsdx(), 0700);
+                        fileDescriptor = HOSTCALL(creat(dsdx(), 0700));
                         if (fileDescriptor != -1) {
                             setCF(false);
                             int guestDescriptor = getDescriptor();
@@ -191,7 +196,7 @@ bool handleSyscallDOS(struct exe *e, int intno)
                         }
                         break;
                     case 0x213d:
-                        fileDescriptor = open(dsdx(), al() & 3, 0700);
+                        fileDescriptor = HOSTCALL(open(dsdx(), al() & 3, 0700));
                         if (fileDescriptor != -1) {
                             setCF(false);
                             setAX(getDescriptor());
@@ -210,7 +215,7 @@ bool handleSyscallDOS(struct exe *e, int intno)
                             break;
                         }
                         if (fileDescriptor >= 5 &&
-                            close(fileDescriptor) != 0) {
+                            HOSTCALL(close(fileDescriptor)) != 0) {
                             setCF(true);
                             setAX(dosError(errno));
                         }
@@ -226,7 +231,8 @@ bool handleSyscallDOS(struct exe *e, int intno)
                             setAX(6);  // Invalid handle
                             break;
                         }
-                        data = read(fileDescriptor, pathBuffers[0], cx());
+                        data = HOSTCALL(read(fileDescriptor, pathBuffers[0], cx()));
+                        replayMemory(pathBuffers[0], (int)data);
                         dsdxparms(true, cx());
                         if (data == (DWord)-1) {
                             setCF(true);
@@ -255,7 +261,7 @@ bool handleSyscallDOS(struct exe *e, int intno)
                         }
                         break;
                     case 0x2141:
-                        if (unlink(dsdx()) == 0)
+                        if (HOSTCALL(unlink(dsdx())) == 0)
                             setCF(false);
                         else {
                             setCF(true);
@@ -269,8 +275,8 @@ bool handleSyscallDOS(struct exe *e, int intno)
                             setAX(6);  // Invalid handle
                             break;
                         }
-                        data = lseek(fileDescriptor, (cx() << 16) + dx(),
-                            al());
+                        data = HOSTCALL(lseek(fileDescriptor, (cx() << 16) + dx(),
+                            al()));
                         if (data != (DWord)-1) {
                             setCF(false);
                             setDX(data >> 16);
@@ -290,7 +296,7 @@ bool handleSyscallDOS(struct exe *e, int intno)
                             setAX(6);  // Invalid handle
                             break;
                         }
-                        data = isatty(fileDescriptor);
+                        data = HOSTCALL(isatty(fileDescriptor));
                         if (data == 1) {
                             setDX(0x80);
                             setCF(false);
@@ -307,7 +313,8 @@ bool handleSyscallDOS(struct exe *e, int intno)
                         }
                         break;
                     case 0x2147:
-                        if (getcwd(pathBuffers[0], 64) != 0) {
+                        if (HOSTCALL(getcwd(pathBuffers[0], 64) != 0)) {
+                            replayMemory(pathBuffers[0], 64);
                             setCF(false);
                             initString(si(), DS, true, 0, 0x10000);
                         }
@@ -337,7 +344,7 @@ bool handleSyscallDOS(struct exe *e, int intno)
                         SysExit(e, 0);
                         break;
                     case 0x2156:
-                        if (rename(dsdx(), initString(di(), ES, false, 1, 0x10000)) == 0)
+                        if (HOSTCALL(rename(dsdx(), initString(di(), ES, false, 1, 0x10000))) == 0)
                             setCF(false);
                         else {
                             setCF(true);
@@ -13,6 +13,8 @@
 #include <sys/stat.h>
 #include "8086.h"
 #include "exe.h"
+#include "replay.h"
+#include "counters.h"
 
 #if BLINK16
 #include "blink/machine.h"
@@ -42,22 +44,27 @@ static int SysWrite(struct exe *e, int fd, char *buf, size_t n)
 #if BLINK16
     extern ssize_t ptyWrite(int fd, char *buf, int len);
     SetWriteAddr(g_machine, buf-(char *)ram, n);
-    return ptyWrite(fd, buf, n);
+    return replayResult(reexecuting || (replaying && fd > 2) ? 0 : ptyWrite(fd, buf, n));
 #else
-    return write(fd, buf, n);
+    return replayResult(reexecuting || (replaying && fd > 2) ? 0 : write(fd, buf, n));
 #endif
 }
 
 static int SysRead(struct exe *e, int fd, char *buf, size_t n)
 {
-    return read(fd, buf, n);
+    int ret = HOSTCALL(read(fd, buf, n));
+
+    replayMemory(buf, ret);
+    if (ret > 0)
+        setDirty(buf - (char *)ram, ret);
+    return ret;
 }
 
 static int SysOpen(struct exe *e, char *path, int oflag, int mode)
 {
     if (f_verbose)
         printf("[sys_open '%s',%d,%x]\n", path, oflag, mode);
-    int ret = open(path, oflag, mode);
+    int ret = HOSTCALL(open(path, oflag, mode));
     if (ret < 0)
         printf("[sys_open failed: %s\n", path);
     return ret;
@@ -65,7 +72,7 @@ static int SysOpen(struct exe *e, char *path, int oflag, int mode)
 
 static int SysClose(struct exe *e, int fd)
 {
-    return close(fd);
+    return HOSTCALL(close(fd));
 }
 
 static int SysBreak(struct exe *e, unsigned newbrk)
@@ -116,6 +123,7 @@ bool handleSyscallElks(struct exe *e, int intno)
     unsigned int CX = cx();
     unsigned int DX = dx();
 
+    counters.elksSyscalls[AX & 0xff]++;
     /* syscall args: BX, CX, DX, DI, SI */
     switch (AX) {
     SYSCALL(1,  SysExit,  (e, BX));
@@ -0,0 +1,206 @@
+/*
+ * Estimated 8086/8088 instruction timing for 8086 emulator
+ *
+ * Each instruction is charged its documented base clocks, register or
+ * memory form, plus effective address calculation and four clocks per
+ * word transfer the bus has to split: every word on the 8-bit 8088,
+ * odd addressed words on the 8086. The prefetch queue is approximated
+ * by filling it during clocks the instruction leaves the bus idle and
+ * stalling when the next instruction is longer than what was queued.
+ * A control transfer empties the queue. 80186 instructions use their
+ * 80186 clocks. When enabled, the estimate also drives cpuClock so
+ * device timers run at the pace the guest would see on hardware.
+ */
+#include "8086.h"
+#include "timing.h"
+#include "checkpoint.h"
+
+#define ALU_REG(n)      [n ... n+3] = 3, [n+4 ... n+5] = 4
+#define ALU_MEM(n, m)   [n ... n+1] = m, [n+2 ... n+3] = 9
+
+bool timing;
+Clock cycles;
+
+static bool bus8;               /* 8088 8-bit data bus */
+static int byteClocks;          /* clocks to prefetch an instruction byte */
+static int queueSize;
+static int queued;              /* bytes in prefetch queue */
+
+/* register operand or no operand, not taken for conditional jumps */
+static const uint8_t regClocks[256] = {
+    ALU_REG(0x00), ALU_REG(0x08), ALU_REG(0x10), ALU_REG(0x18),
+    ALU_REG(0x20), ALU_REG(0x28), ALU_REG(0x30), ALU_REG(0x38),
+    [0x06] = 10, [0x0e] = 10, [0x16] = 10, [0x1e] = 10,     /* PUSH seg */
+    [0x07] = 8,  [0x0f] = 8,  [0x17] = 8,  [0x1f] = 8,      /* POP seg */
+    [0x26] = 2,  [0x2e] = 2,  [0x36] = 2,  [0x3e] = 2,      /* seg: */
+    [0x27] = 4,  [0x2f] = 4,  [0x37] = 4,  [0x3f] = 4,      /* DAA etc */
+    [0x40 ... 0x4f] = 2,
+    [0x50 ... 0x57] = 11,
+    [0x58 ... 0x5f] = 8,
+    [0x60] = 36, [0x61] = 51, [0x62] = 33,                  /* 80186 */
+    [0x68] = 10, [0x69] = 22, [0x6a] = 10, [0x6b] = 22,
+    [0x6c ... 0x6f] = 14,
+    [0x70 ... 0x7f] = 4,
+    [0x80 ... 0x83] = 4,
+    [0x84 ... 0x85] = 3,
+    [0x86 ... 0x87] = 4,
+    [0x88 ... 0x8e] = 2,
+    [0x8f] = 8,
+    [0x90 ... 0x97] = 3,
+    [0x98] = 2,  [0x99] = 5,  [0x9a] = 28, [0x9b] = 4,
+    [0x9c] = 10, [0x9d] = 8,  [0x9e ... 0x9f] = 4,
+    [0xa0 ... 0xa3] = 10,
+    [0xa4 ... 0xa5] = 18,       /* string clocks when not repeated */
+    [0xa6 ... 0xa7] = 22,
+    [0xa8 ... 0xa9] = 4,
+    [0xaa ... 0xab] = 11,
+    [0xac ... 0xad] = 12,
+    [0xae ... 0xaf] = 15,
+    [0xb0 ... 0xbf] = 4,
+    [0xc0 ... 0xc1] = 5,
+    [0xc2] = 12, [0xc3] = 8,  [0xc4 ... 0xc5] = 16, [0xc6 ... 0xc7] = 4,
+    [0xc8] = 15, [0xc9] = 8,  [0xca] = 17, [0xcb] = 18,
+    [0xcc] = 52, [0xcd] = 51, [0xce] = 4,  [0xcf] = 24,
+    [0xd0 ... 0xd1] = 2,
+    [0xd2 ... 0xd3] = 8,
+    [0xd4] = 83, [0xd5] = 60, [0xd6] = 3,  [0xd7] = 11,
+    [0xd8 ... 0xdf] = 2,
+    [0xe0] = 5,  [0xe1] = 6,  [0xe2] = 5,  [0xe3] = 6,
+    [0xe4 ... 0xe7] = 10,
+    [0xe8] = 19,
+    [0xe9 ... 0xeb] = 15,
+    [0xec ... 0xef] = 8,
+    [0xf0 ... 0xf1] = 2,
+    [0xf2 ... 0xf3] = 9,
+    [0xf4 ... 0xf5] = 2,
+    [0xf8 ... 0xfd] = 2,
+};
+
+/* memory operand, effective address calculation not included */
+static const uint8_t memClocks[256] = {
+    ALU_MEM(0x00, 16), ALU_MEM(0x08, 16), ALU_MEM(0x10, 16), ALU_MEM(0x18, 16),
+    ALU_MEM(0x20, 16), ALU_MEM(0x28, 16), ALU_MEM(0x30, 16), ALU_MEM(0x38, 9),
+    [0x62] = 33, [0x69] = 25, [0x6b] = 25,
+    [0x80 ... 0x83] = 17,
+    [0x84 ... 0x85] = 9,
+    [0x86 ... 0x87] = 17,
+    [0x88 ... 0x89] = 9,
+    [0x8a ... 0x8b] = 8,
+    [0x8c] = 9,  [0x8d] = 2,  [0x8e] = 8,  [0x8f] = 17,
+    [0xc0 ... 0xc1] = 17,
+    [0xc4 ... 0xc5] = 16,
+    [0xc6 ... 0xc7] = 10,
+    [0xd0 ... 0xd1] = 15,
+    [0xd2 ... 0xd3] = 20,
+    [0xd8 ... 0xdf] = 8,
+};
+
+/* conditional control transfers when taken */
+static const uint8_t takenClocks[256] = {
+    [0x70 ... 0x7f] = 16,
+    [0xce] = 53,
+    [0xe0] = 19, [0xe1] = 18, [0xe2] = 17, [0xe3] = 18,
+};
+
+/* repetitions of string instructions under REP */
+static const uint8_t repClocks[16] = {
+    17, 17, 22, 22, 0, 0, 10, 10, 13, 13, 15, 15,
+};
+
+/* F6/F7 by reg field: TEST NOT NEG MUL IMUL DIV IDIV, byte then word */
+static const uint8_t mathClocks[8][2] = {
+    { 5, 5 }, { 5, 5 }, { 3, 3 }, { 3, 3 },
+    { 74, 126 }, { 89, 141 }, { 85, 153 }, { 107, 175 },
+};
+
+/* FE/FF by reg field: INC DEC CALL CALLF JMP JMPF PUSH, register then memory */
+static const uint8_t miscClocks[8][2] = {
+    { 3, 15 }, { 3, 15 }, { 16, 21 }, { 37, 37 },
+    { 11, 18 }, { 24, 24 }, { 11, 16 }, { 11, 16 },
+};
+
+/* enable timing model for 8088 (8-bit bus) or 8086 */
+void setTiming(bool bus8bit)
+{
+    timing = true;
+    bus8 = bus8bit;
+    byteClocks = bus8 ? 4 : 2;
+    queueSize = bus8 ? 4 : 6;
+}
+
+void resetTiming(void)
+{
+    queued = 0;
+    cycles = 0;
+    addState(&queued, sizeof(queued));
+    addState(&cycles, sizeof(cycles));
+}
+
+static void charge(int clocks, const struct insnTiming *t)
+{
+    int stall = 0;
+    int idle;
+
+    clocks += 4 * (bus8 ? t->words : t->oddWords);
+    if (t->length > queued) {
+        stall = (t->length - queued) * byteClocks;
+        queued = 0;
+    } else
+        queued -= t->length;
+    if (t->transfer)
+        queued = 0;
+    else {
+        idle = clocks - t->words * (bus8 ? 8 : 4);
+        if (idle > 0)
+            queued += idle / byteClocks;
+        if (queued > queueSize)
+            queued = queueSize;
+    }
+    clocks += stall;
+    cycles += clocks;
+    cpuClock += clocks;
+}
+
+static int baseClocks(const struct insnTiming *t)
+{
+    int op = t->opcode;
+    int reg = (t->modRM >> 3) & 7;
+    int clocks;
+
+    switch (op) {
+    case 0x80 ... 0x83:
+        if (t->memory && reg == 7)      /* CMP doesn't write back */
+            return 10 + t->ea;
+        break;
+    case 0xa4 ... 0xaf:
+        if (t->rep && repClocks[op - 0xa4])
+            return repClocks[op - 0xa4];
+        break;
+    case 0xc0 ... 0xc1:
+        return (t->memory ? memClocks[op] + t->ea : regClocks[op]) + t->count;
+    case 0xd2 ... 0xd3:
+        return (t->memory ? memClocks[op] + t->ea : regClocks[op]) + 4 * t->count;
+    case 0xf6 ... 0xf7:
+        clocks = mathClocks[reg][op & 1];
+        if (t->memory)                  /* TEST +6, NOT NEG +13, MUL DIV +6 */
+            clocks += t->ea + (reg == 2 || reg == 3 ? 13 : 6);
+        return clocks;
+    case 0xfe ... 0xff:
+        return miscClocks[reg][t->memory] + (t->memory ? t->ea : 0);
+    }
+    if (t->transfer && takenClocks[op])
+        return takenClocks[op];
+    if (t->memory && memClocks[op])
+        return memClocks[op] + t->ea;
+    return regClocks[op];
+}
+
+void chargeInstruction(const struct insnTiming *t)
+{
+    charge(baseClocks(t), t);
+}
+
+void chargeInterrupt(const struct insnTiming *t)
+{
+    charge(61, t);
+}
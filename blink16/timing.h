@@ -0,0 +1,31 @@
+#ifndef TIMING_H_
+#define TIMING_H_
+/* estimated 8086/8088 instruction timing for 8086 emulator */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sched.h"
+
+/* what an executed instruction did, gathered by the interpreter */
+struct insnTiming {
+    uint8_t opcode;
+    uint8_t modRM;
+    bool memory;            /* r/m operand in memory */
+    bool rep;               /* REP prefix active */
+    bool transfer;          /* control transferred, prefetch queue flushed */
+    int ea;                 /* effective address calculation clocks */
+    int words;              /* word memory transfers */
+    int oddWords;           /* word transfers at odd addresses */
+    int length;             /* instruction bytes fetched */
+    int count;              /* shift or rotate count */
+};
+
+extern bool timing;         /* timing model enabled */
+extern Clock cycles;        /* estimated processor clocks executed */
+
+void setTiming(bool bus8);
+void resetTiming(void);
+void chargeInstruction(const struct insnTiming *t);
+void chargeInterrupt(const struct insnTiming *t);
+
+#endif
@@ -0,0 +1,270 @@
+/*
+ * Compact binary execution trace for 8086 emulator
+ *
+ * Each instruction is encoded as a tag byte and an IP delta, followed
+ * only by what changed: CS, the registers that differ from the last
+ * record, the bytes written to memory, and the instruction bytes when
+ * the reader hasn't seen them at that address yet. A copy of memory as
+ * the reader knows it decides which code bytes to send, kept by linear
+ * address so the reader needn't know the A20 gate. Writes made
+ * outside of instructions, by the loader, go in a record of their own
+ * so the reader's memory stays in step. Records are appended to one of
+ * a ring of large blocks, and a writer thread writes out full blocks
+ * while the emulator carries on, so the only per instruction cost is
+ * the encoding. The emulator waits only when every block is queued.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "8086.h"
+#include "trace.h"
+
+#define BLOCKSIZE   (1 << 20)
+#define NBLOCKS     8
+#define MAXRUNS     64          /* runs of bytes written by one instruction */
+#define MAXWRITE    256
+#define MAXREC      (16 + 256 + 2 + 13 * 2 + 4 + MAXRUNS * 4 + MAXWRITE)
+
+bool tracing;
+
+static int fd;
+static Byte *blocks[NBLOCKS];
+static int blockLen[NBLOCKS];
+static unsigned filled;         /* blocks handed to writer */
+static unsigned written;        /* blocks written by writer */
+static bool done;
+static pthread_t writerThread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static Byte *out;               /* block being filled */
+static int pos;
+
+static Byte known[MEMSIZE];     /* memory as the reader has it */
+static Word lastRegs[13];
+static Word lastIP;
+static Word lastCS;
+
+static struct {
+    uint32_t addr;
+    int len;
+} runs[MAXRUNS];
+static int nruns;
+static Byte runBytes[MAXWRITE];
+static int nbytes;
+
+static void *writer(void *arg)
+{
+    unsigned n;
+    Byte *p;
+    int len, rc;
+
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (written == filled && !done)
+            pthread_cond_wait(&cond, &lock);
+        if (written == filled)
+            break;
+        n = written % NBLOCKS;
+        pthread_mutex_unlock(&lock);
+        for (p=blocks[n], len=blockLen[n]; len > 0; p += rc, len -= rc) {
+            if ((rc = write(fd, p, len)) <= 0) {
+                perror("trace");
+                break;
+            }
+        }
+        pthread_mutex_lock(&lock);
+        written++;
+        pthread_cond_broadcast(&cond);
+    }
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+/* hand the filled block to the writer, waiting for a free one */
+static void submit(void)
+{
+    blockLen[filled % NBLOCKS] = pos;
+    pthread_mutex_lock(&lock);
+    filled++;
+    pthread_cond_broadcast(&cond);
+    while (filled - written >= NBLOCKS)
+        pthread_cond_wait(&cond, &lock);
+    pthread_mutex_unlock(&lock);
+    out = blocks[filled % NBLOCKS];
+    pos = 0;
+}
+
+int startTrace(const char *path)
+{
+    int i, version = TRACE_VERSION;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        return -1;
+    if (write(fd, TRACE_MAGIC, 4) != 4 ||
+        write(fd, &version, sizeof(version)) != sizeof(version)) {
+        close(fd);
+        return -1;
+    }
+    for (i=0; i<NBLOCKS; i++) {
+        if (!(blocks[i] = malloc(BLOCKSIZE)))
+            runtimeError("Out of memory for trace buffers\n");
+    }
+    out = blocks[0];
+    if (pthread_create(&writerThread, 0, writer, 0))
+        runtimeError("Can't start trace writer\n");
+    tracing = true;
+    atexit(stopTrace);
+    return 0;
+}
+
+void stopTrace(void)
+{
+    if (!tracing)
+        return;
+    tracing = false;
+    submit();
+    pthread_mutex_lock(&lock);
+    done = true;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+    pthread_join(writerThread, 0);
+    close(fd);
+}
+
+static inline Byte *putWord(Byte *p, Word w)
+{
+    p[0] = w;
+    p[1] = w >> 8;
+    return p + 2;
+}
+
+static inline Byte *putVarint(Byte *p, uint32_t v)
+{
+    while (v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static Byte *putWrites(Byte *p)
+{
+    Byte *b = runBytes;
+    int i, j;
+
+    p = putVarint(p, nruns);
+    for (i=0; i<nruns; i++) {
+        *p++ = runs[i].addr;
+        *p++ = runs[i].addr >> 8;
+        *p++ = runs[i].addr >> 16;
+        *p++ = runs[i].len;
+        for (j=0; j<runs[i].len; j++)
+            *p++ = *b++;
+    }
+    nruns = nbytes = 0;
+    return p;
+}
+
+/* send writes made by the loader, or too many for one record */
+static void flushWrites(void)
+{
+    Byte *p = out + pos;
+
+    *p++ = TR_DATA;
+    p = putWrites(p);
+    pos = p - out;
+    if (pos > BLOCKSIZE - MAXREC)
+        submit();
+}
+
+void traceProgram(uint16_t textseg, uint16_t ftextseg, uint16_t dataseg)
+{
+    Byte *p;
+
+    if (nruns)
+        flushWrites();
+    p = out + pos;
+    *p++ = TR_PROGRAM;
+    p = putWord(p, textseg);
+    p = putWord(p, ftextseg);
+    p = putWord(p, dataseg);
+    pos = p - out;
+}
+
+void traceWrite(uint32_t addr, uint8_t value)
+{
+    known[addr] = value;
+    if (nbytes == MAXWRITE)
+        flushWrites();
+    if (nruns && runs[nruns-1].addr + runs[nruns-1].len == addr &&
+        runs[nruns-1].len < 255)
+        runs[nruns-1].len++;
+    else {
+        if (nruns == MAXRUNS)
+            flushWrites();
+        runs[nruns].addr = addr;
+        runs[nruns++].len = 1;
+    }
+    runBytes[nbytes++] = value;
+}
+
+void traceInstruction(uint16_t cs, uint16_t ip, int length, bool interrupt)
+{
+    Byte *p = out + pos;
+    Byte *tag = p++;
+    DWord a;
+    Word flags = getFlags();
+    int i, d, mask;
+
+    *tag = interrupt ? TR_INTERRUPT : 0;
+    d = (int16_t)(ip - lastIP);
+    p = putVarint(p, (d << 1) ^ (d >> 31));
+    lastIP = ip;
+    if (cs != lastCS) {
+        *tag |= TR_CS;
+        p = putWord(p, cs);
+        lastCS = cs;
+    }
+    for (i=0; i<length; i++) {
+        a = ((DWord)cs << 4) + (Word)(ip + i);
+        if (known[a] != ram[wrapA20(a)])
+            break;
+    }
+    if (i < length) {
+        *tag |= TR_CODE;
+        *p++ = length;
+        for (i=0; i<length; i++) {
+            a = ((DWord)cs << 4) + (Word)(ip + i);
+            *p++ = known[a] = ram[wrapA20(a)];
+        }
+    }
+    mask = 0;
+    for (i=0; i<12; i++) {
+        if (regs.w[i] != lastRegs[i])
+            mask |= 1 << i;
+    }
+    if (flags != lastRegs[TR_FLAGS])
+        mask |= 1 << TR_FLAGS;
+    if (mask) {
+        *tag |= TR_REGS;
+        p = putWord(p, mask);
+        for (i=0; i<12; i++) {
+            if (mask & (1 << i))
+                p = putWord(p, lastRegs[i] = regs.w[i]);
+        }
+        if (mask & (1 << TR_FLAGS))
+            p = putWord(p, lastRegs[TR_FLAGS] = flags);
+    }
+    if (nruns) {
+        *tag |= TR_WRITES;
+        p = putWrites(p);
+    }
+    pos = p - out;
+    if (pos > BLOCKSIZE - MAXREC)
+        submit();
+}
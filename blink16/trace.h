@@ -0,0 +1,45 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+/* compact binary execution trace for 8086 emulator */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TRACE_MAGIC     "B16T"
+#define TRACE_VERSION   1
+
+/*
+ * Trace file: magic, 32-bit version, then records. An instruction
+ * record starts with a tag byte of TR_ flags, then:
+ *  zigzag varint IP delta from previous record
+ *  CS word                                     if TR_CS
+ *  byte count, instruction bytes at CS:IP      if TR_CODE
+ *  word mask of registers, value words         if TR_REGS
+ *  varint run count, runs of
+ *      3-byte linear address, byte count, bytes if TR_WRITES
+ * Registers are numbered as regs.w[] with flags as 12, values are
+ * those after the instruction. Code bytes are only sent when they
+ * differ from what the reader already has for those addresses.
+ * A TR_PROGRAM record holds text, far text and data segment words,
+ * a TR_DATA record runs of writes made outside of an instruction.
+ * All values are little endian.
+ */
+#define TR_CS           0x01    /* code segment changed */
+#define TR_CODE         0x02    /* instruction bytes follow */
+#define TR_REGS         0x04    /* changed registers follow */
+#define TR_WRITES       0x08    /* memory writes follow */
+#define TR_INTERRUPT    0x10    /* hardware interrupt taken, no instruction */
+#define TR_PROGRAM      0x80    /* program loaded, segments follow */
+#define TR_DATA         0x81    /* memory writes follow */
+
+#define TR_FLAGS        12      /* register mask bit for flags */
+
+extern bool tracing;
+
+int startTrace(const char *path);
+void stopTrace(void);
+void traceProgram(uint16_t textseg, uint16_t ftextseg, uint16_t dataseg);
+void traceWrite(uint32_t addr, uint8_t value);
+void traceInstruction(uint16_t cs, uint16_t ip, int length, bool interrupt);
+
+#endif
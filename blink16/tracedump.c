@@ -0,0 +1,212 @@
+/*
+ * Decode a binary execution trace written by blink16 --trace
+ *
+ * Usage: tracedump [-n] [-s symfile | -e executable] tracefile
+ *
+ * Prints each traced instruction disassembled, with the registers it
+ * changed and the memory it wrote. Memory is rebuilt from the code
+ * bytes and writes in the trace, so instructions disassemble as they
+ * were executed. Symbols come from an ELKS executable or a system.sym
+ * file, for the segments recorded when the program was loaded.
+ * Word stores are shown as words, other writes as bytes apart. Only
+ * stores made through the core are traced, not those made in bulk by
+ * BIOS disk reads or emulated system calls such as read, so memory
+ * they fill shows as it was before.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "exe.h"
+#include "disasm.h"
+#include "discolor.h"
+#include "syms.h"
+#include "trace.h"
+
+#define MEMSIZE     0x110000    /* 1M and the HMA */
+
+static unsigned char ram[MEMSIZE];
+static unsigned short regs[13];
+static const char *regnames[13] = {
+    "ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+    "es", "cs", "ss", "ds", "flags"
+};
+static FILE *fp;
+static char *tracefile;
+
+static int getByte(void)
+{
+    int c = getc(fp);
+
+    if (c == EOF) {
+        fprintf(stderr, "%s: trace truncated\n", tracefile);
+        exit(1);
+    }
+    return c;
+}
+
+static unsigned int getWord(void)
+{
+    unsigned int w = getByte();
+    return w | (getByte() << 8);
+}
+
+static unsigned int getVarint(void)
+{
+    unsigned int v = 0;
+    int c, shift = 0;
+
+    do {
+        c = getByte();
+        v |= (c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return v;
+}
+
+/*
+ * apply runs of writes to memory, listing them unless brief: a run of
+ * two bytes is a word store and shown as its value, others byte by byte
+ */
+static char *getWrites(char *p, char *end, int brief)
+{
+    unsigned int runs, addr;
+    int i, n, c;
+
+    runs = getVarint();
+    while (runs--) {
+        addr = getByte();
+        addr |= getByte() << 8;
+        addr |= getByte() << 16;
+        n = getByte();
+        if (!brief && p < end - 16)
+            p += sprintf(p, " [%05x]=", addr);
+        for (i=0; i<n; i++) {
+            c = getByte();
+            if (addr + i < MEMSIZE)
+                ram[addr + i] = c;
+        }
+        if (brief || p >= end - 16)
+            continue;
+        if (n == 2)
+            p += sprintf(p, "%04x", ram[(addr + 1) % MEMSIZE] << 8 |
+                ram[addr % MEMSIZE]);
+        else {
+            for (i=0; i<n && p < end - 4; i++)
+                p += sprintf(p, &" %02x"[i == 0], ram[(addr + i) % MEMSIZE]);
+        }
+    }
+    return p;
+}
+
+static int nextbyte(int cs, int ip)
+{
+    return ram[((unsigned)cs << 4) + (unsigned short)ip];
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: tracedump [-n] [-s symfile | -e executable] tracefile\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct exe e;
+    struct dis d;
+    char magic[4], *p, line[512];
+    char *symfile = NULL, *exefile = NULL;
+    int i, len, tag, version, ch;
+    unsigned int ip = 0, cs = 0, mask, delta;
+    int brief = 0;
+    unsigned long count = 0;
+
+    while ((ch = getopt(argc, argv, "ns:e:")) != -1) {
+        switch (ch) {
+        case 'n':
+            brief = 1;
+            break;
+        case 's':
+            symfile = optarg;
+            break;
+        case 'e':
+            exefile = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind + 1 != argc)
+        usage();
+    tracefile = argv[optind];
+    if (!(fp = fopen(tracefile, "rb"))) {
+        perror(tracefile);
+        return 1;
+    }
+    if (fread(magic, 4, 1, fp) != 1 || memcmp(magic, TRACE_MAGIC, 4) ||
+        fread(&version, sizeof(version), 1, fp) != 1 || version != TRACE_VERSION) {
+        fprintf(stderr, "%s: not a blink16 trace\n", tracefile);
+        return 1;
+    }
+    memset(&e, 0, sizeof(e));
+    if (exefile && !sym_read_exe_symbols(&e, exefile))
+        fprintf(stderr, "%s: no symbols\n", exefile);
+    if (symfile && !sym_read_symbols(&e, symfile))
+        fprintf(stderr, "%s: no symbols\n", symfile);
+    memset(&d, 0, sizeof(d));
+    d.e = &e;
+    g_high.enabled = 0;
+
+    while ((tag = getc(fp)) != EOF) {
+        if (tag == TR_PROGRAM) {
+            e.textseg = getWord();
+            e.ftextseg = getWord();
+            e.dataseg = getWord();
+            continue;
+        }
+        if (tag == TR_DATA) {
+            getWrites(line, line + sizeof(line), 1);
+            continue;
+        }
+        delta = getVarint();
+        ip = (ip + (int)((delta >> 1) ^ -(delta & 1))) & 0xffff;
+        if (tag & TR_CS)
+            cs = getWord();
+        len = 0;
+        if (tag & TR_CODE) {
+            len = getByte();
+            for (i=0; i<len; i++)
+                ram[(cs << 4) + (unsigned short)(ip + i)] = getByte();
+        }
+        p = line;
+        if (!brief && e.syms && (cs == e.textseg || (e.ftextseg && cs == e.ftextseg))) {
+            int far = e.ftextseg && cs == e.ftextseg;
+            if ((far ? sym_ftext_fn_start_address(&e, ip) : sym_fn_start_address(&e, ip)) == ip)
+                printf("%s:\n", far ? sym_ftext_symbol(&e, ip, 1) : sym_text_symbol(&e, ip, 1));
+        }
+        if (tag & TR_INTERRUPT)
+            p += sprintf(p, "%04x:%04x interrupt", cs, ip);
+        else {
+            disasm(&d, cs, ip, nextbyte, regs[11], fDisCS | fDisIP | fDisBytes | fDisInst);
+            p += sprintf(p, "%s", d.buf);
+            count++;
+        }
+        if (tag & TR_REGS) {
+            mask = getWord();
+            if (!brief)
+                p += sprintf(p, "%*s", (int)(p - line < 56 ? 56 - (p - line) : 1), "");
+            for (i=0; i<13; i++) {
+                if (mask & (1 << i)) {
+                    regs[i] = getWord();
+                    if (!brief)
+                        p += sprintf(p, " %s=%04x", regnames[i], regs[i]);
+                }
+            }
+        }
+        if (tag & TR_WRITES)
+            p = getWrites(p, line + sizeof(line), brief);
+        printf("%s\n", line);
+    }
+    fprintf(stderr, "%lu instructions\n", count);
+    return 0;
+}
@@ -0,0 +1,319 @@
+/*
+ * 16550A UART emulation for 8086 emulator
+ *
+ * COM1 at 3F8h/IRQ4 and COM2 at 2F8h/IRQ3, each attached to a host
+ * file descriptor: stdio, a new pty, a named pipe or a plain file.
+ * Transmit is immediate into a host side buffer, so THR is always
+ * empty. A scheduler event every millisecond of guest time flushes
+ * output and moves any waiting host input into the receive FIFO.
+ * Only attached ports are decoded, others read back as open bus.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include "blink/uart.h"
+#include "devices.h"
+#include "sched.h"
+#include "portio.h"
+#include "replay.h"
+#include "checkpoint.h"
+#include "counters.h"
+
+#define UART_RBR    0               /* receive buffer register */
+#define UART_THR    0               /* transmit holding register */
+#define UART_IER    1               /* interrupt enable register */
+#define UART_FCR    2               /* FIFO control register */
+#define UART_MSR    6               /* modem status register */
+#define UART_SCR    7               /* scratch register */
+
+#define IER_RDA     0x01            /* received data available */
+#define IER_THRE    0x02            /* transmit holding register empty */
+#define IIR_NONE    0x01
+#define IIR_THRE    0x02
+#define IIR_RDA     0x04
+#define IIR_TIMEOUT 0x0c
+#define IIR_FIFO    0xc0
+#define MCR_OUT2    0x08            /* gates IRQ onto the bus on the PC */
+#define MCR_LOOP    0x10
+
+#define FIFOSIZE    16
+#define TXBUFSIZE   4096
+#define POLLCLOCKS  (CPU_HZ / 1000)
+
+struct uart {
+    uint16_t base;
+    int irq;
+    int infd, outfd;                /* -1 if not attached */
+    uint8_t ier, lcr, mcr, lsr, scr, dll, dlm, fcr;
+    bool threPending;               /* THRE interrupt not yet reported */
+    uint8_t rx[FIFOSIZE];
+    int rxHead, rxCount;
+    char tx[TXBUFSIZE];
+    int txCount;
+};
+
+static struct uart com[2] = {
+    { .base = 0x3f8, .irq = 4, .infd = -1, .outfd = -1 },
+    { .base = 0x2f8, .irq = 3, .infd = -1, .outfd = -1 },
+};
+
+static struct uart *portToUart(uint16_t port)
+{
+    return &com[(port & 0xff00) == 0x200];
+}
+
+static int rxTrigger(struct uart *u)
+{
+    static const int level[4] = { 1, 4, 8, 14 };
+
+    return (u->fcr & 1) ? level[u->fcr >> 6] : 1;
+}
+
+static uint8_t interruptId(struct uart *u)
+{
+    uint8_t fifo = (u->fcr & 1) ? IIR_FIFO : 0;
+
+    if ((u->ier & IER_RDA) && u->rxCount)
+        return fifo | (u->rxCount >= rxTrigger(u) ? IIR_RDA : IIR_TIMEOUT);
+    if ((u->ier & IER_THRE) && u->threPending)
+        return fifo | IIR_THRE;
+    return fifo | IIR_NONE;
+}
+
+static void updateIRQ(struct uart *u)
+{
+    if ((u->mcr & MCR_OUT2) && !(interruptId(u) & IIR_NONE))
+        picRaiseIRQ(u->irq);
+    else
+        picLowerIRQ(u->irq);
+}
+
+static void flushTx(struct uart *u)
+{
+    int n, off = 0;
+
+    while (off < u->txCount && !reexecuting) {   /* already sent */
+        n = write(u->outfd, u->tx + off, u->txCount - off);
+        if (n <= 0)
+            break;
+        off += n;
+    }
+    counters.outputBytes += off;
+    u->txCount = 0;
+}
+
+static void receive(struct uart *u, uint8_t c)
+{
+    if (u->rxCount == FIFOSIZE) {
+        u->lsr |= UART_TTYOE;
+        return;
+    }
+    u->rx[(u->rxHead + u->rxCount++) % FIFOSIZE] = c;
+}
+
+static void pollHost(struct uart *u)
+{
+    struct pollfd pfd;
+    uint8_t buf[FIFOSIZE];
+    int i, n;
+
+    if (u->txCount)
+        flushTx(u);
+    if (u->infd < 0 || u->rxCount == FIFOSIZE)
+        return;
+    pfd.fd = u->infd;
+    pfd.events = POLLIN;
+    if (!replayPresent(!replaying && poll(&pfd, 1, 0) == 1 &&
+            (pfd.revents & POLLIN)))
+        return;
+    n = HOSTCALL(read(u->infd, buf, FIFOSIZE - u->rxCount));
+    replayMemory(buf, n);
+    for (i=0; i<n; i++)
+        receive(u, buf[i]);
+}
+
+static void pollEvent(Clock when)
+{
+    int i;
+
+    for (i=0; i<2; i++) {
+        if (com[i].outfd >= 0) {
+            pollHost(&com[i]);
+            updateIRQ(&com[i]);
+        }
+    }
+    scheduleEvent(EV_UART, when + POLLCLOCKS, pollEvent);
+}
+
+static uint8_t uartRead(uint16_t port)
+{
+    struct uart *u = portToUart(port);
+    bool dlab = u->lcr & UART_DLAB;
+    uint8_t value;
+
+    switch (port & 7) {
+    case UART_RBR:
+        if (dlab)
+            return u->dll;
+        if (!u->rxCount)
+            return 0;
+        value = u->rx[u->rxHead];
+        u->rxHead = (u->rxHead + 1) % FIFOSIZE;
+        u->rxCount--;
+        if (!u->rxCount && !(u->mcr & MCR_LOOP))
+            pollHost(u);
+        break;
+    case UART_IER:
+        return dlab ? u->dlm : u->ier;
+    case UART_IIR:
+        value = interruptId(u);
+        if ((value & 0x0f) == IIR_THRE)
+            u->threPending = false;
+        break;
+    case UART_LCR:
+        return u->lcr;
+    case UART_MCR:
+        return u->mcr;
+    case UART_LSR:
+        value = u->lsr | UART_TTYTXR | UART_TTYIDL;
+        if (u->rxCount)
+            value |= UART_TTYDA;
+        u->lsr = 0;
+        return value;
+    case UART_MSR:
+        if (u->mcr & MCR_LOOP)      /* RTS->CTS DTR->DSR OUT1->RI OUT2->DCD */
+            return (u->mcr & 0x02) << 3 | (u->mcr & 0x01) << 5 |
+                   (u->mcr & 0x04) << 4 | (u->mcr & 0x08) << 4;
+        return 0xb0;                /* DCD DSR CTS */
+    default:
+        return u->scr;
+    }
+    updateIRQ(u);
+    return value;
+}
+
+static void uartWrite(uint16_t port, uint8_t value)
+{
+    struct uart *u = portToUart(port);
+    bool dlab = u->lcr & UART_DLAB;
+
+    switch (port & 7) {
+    case UART_THR:
+        if (dlab) {
+            u->dll = value;
+            return;
+        }
+        if (u->mcr & MCR_LOOP)
+            receive(u, value);
+        else {
+            u->tx[u->txCount++] = value;
+            if (u->txCount == TXBUFSIZE || value == '\n')
+                flushTx(u);
+        }
+        u->threPending = true;
+        break;
+    case UART_IER:
+        if (dlab) {
+            u->dlm = value;
+            return;
+        }
+        if ((value & IER_THRE) && !(u->ier & IER_THRE))
+            u->threPending = true;
+        u->ier = value & 0x0f;
+        break;
+    case UART_FCR:
+        if (value & 0x02)
+            u->rxHead = u->rxCount = 0;
+        if (value & 0x04)
+            flushTx(u);
+        u->fcr = value & 0xc1;
+        break;
+    case UART_LCR:
+        u->lcr = value;
+        return;
+    case UART_MCR:
+        u->mcr = value & 0x1f;
+        break;
+    case UART_SCR:
+        u->scr = value;
+        return;
+    default:
+        return;
+    }
+    updateIRQ(u);
+}
+
+/*
+ * Attach COM1 (n=0) or COM2 (n=1) to a host file:
+ *   "-"    stdin and stdout
+ *   "pty"  a new pseudo terminal, its name printed on stderr
+ *   path   a tty or named pipe for both, else a file truncated for output
+ */
+int uartAttach(int n, const char *spec)
+{
+    struct uart *u = &com[n];
+    struct stat st;
+    int fd;
+
+    if (!strcmp(spec, "-")) {
+        u->infd = 0;
+        u->outfd = 1;
+        return 0;
+    }
+    if (!strcmp(spec, "pty")) {
+        if ((fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0 || grantpt(fd) ||
+            unlockpt(fd))
+            return -1;
+        fprintf(stderr, "COM%d: %s\n", n + 1, ptsname(fd));
+        u->infd = u->outfd = fd;
+        return 0;
+    }
+    if (!stat(spec, &st) && (S_ISCHR(st.st_mode) || S_ISFIFO(st.st_mode))) {
+        if ((fd = open(spec, O_RDWR | O_NOCTTY)) < 0)
+            return -1;
+        u->infd = u->outfd = fd;
+        return 0;
+    }
+    if ((fd = open(spec, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+        return -1;
+    u->outfd = fd;
+    return 0;
+}
+
+void uartFlush(void)
+{
+    int i;
+
+    for (i=0; i<2; i++) {
+        if (com[i].txCount)
+            flushTx(&com[i]);
+    }
+}
+
+void initUART(void)
+{
+    int i;
+    bool attached = false;
+
+    for (i=0; i<2; i++) {
+        struct uart *u = &com[i];
+        if (u->outfd < 0)
+            continue;
+        u->ier = u->mcr = u->lsr = u->scr = u->fcr = 0;
+        u->lcr = 0x03;              /* 8N1 */
+        u->dll = 12;                /* 9600 baud */
+        u->dlm = 0;
+        u->threPending = false;
+        u->rxHead = u->rxCount = 0;
+        registerPorts(u->base, 8, uartRead, uartWrite);
+        attached = true;
+    }
+    if (attached)
+        scheduleEvent(EV_UART, cpuClock + POLLCLOCKS, pollEvent);
+    addState(com, sizeof(com));
+}